@@ -0,0 +1,47 @@
+// Per-image latency of Network::detect versus Network::detect_batch at batch sizes 1, 2, 4 and 8.
+// Usage: bench_batch [prototxt] [caffemodel] [iterations]
+#include <iomanip>
+
+#include "net.h"
+
+int main(int argc, char** argv) {
+    std::string modelConfiguration = argc > 1 ? argv[1] : "model/MobileNetSSDV2_deploy.prototxt";
+    std::string modelBinary = argc > 2 ? argv[2] : "model/MobileNetSSDV2.caffemodel";
+    int iterations = argc > 3 ? std::atoi(argv[3]) : 20;
+    const int batchSizes[] = {1, 2, 4, 8};
+
+    Network mobilenet(modelConfiguration, modelBinary);
+    mobilenet.initialize();
+
+    // Fixed-seed noise frames so every run feeds the same input
+    cv::theRNG().state = 42;
+    std::vector<cv::Mat> frames(8);
+    for (std::size_t i = 0; i < frames.size(); i++) {
+        frames[i].create(720, 1280, CV_8UC3);
+        cv::randu(frames[i], cv::Scalar::all(0), cv::Scalar::all(255));
+    }
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "batch  single_ms_per_image  batched_ms_per_image  speedup" << std::endl;
+    for (int batch : batchSizes) {
+        std::vector<cv::Mat> input(frames.begin(), frames.begin() + batch);
+        mobilenet.detect(input[0]); // Warm up both input shapes
+        mobilenet.detect_batch(input);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int n = 0; n < iterations; n++) {
+            for (int i = 0; i < batch; i++)
+                mobilenet.detect(input[i]);
+        }
+        double singleMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / (iterations * batch);
+
+        start = std::chrono::steady_clock::now();
+        for (int n = 0; n < iterations; n++)
+            mobilenet.detect_batch(input);
+        double batchedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / (iterations * batch);
+
+        std::cout << std::setw(5) << batch << "  " << std::setw(19) << singleMs << "  " << std::setw(20) << batchedMs
+                  << "  " << std::setw(7) << singleMs / batchedMs << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,90 @@
+// Per-frame cost of getting a frame ready for the perception stages: the single-branch cv::VideoCapture path (full BGR
+// frame, gray conversion, blob resize) versus DualCapture (luma plane and network-size BGR straight from the pipeline).
+// Reports process CPU time per frame, which includes the GStreamer threads, and the delivered frame rate.
+// Usage: bench_capture [test | video file] [frames]
+#include <ctime>
+#include <iomanip>
+
+#include "net.h"
+#include "camera.h"
+#include "pyramid.h"
+
+volatile float sink; // Keeps the compiler from dropping results
+
+struct CaptureResult {
+    int frames = 0;
+    double cpuMs = 0.0;  // Per frame
+    double wallMs = 0.0; // Per frame
+};
+
+void print(const std::string& name, const CaptureResult& result) {
+    std::cout << std::left << std::setw(10) << name << std::right << std::setw(8) << result.frames << std::setw(14) << result.cpuMs
+              << std::setw(12) << (result.wallMs > 0.0 ? 1000.0 / result.wallMs : 0.0) << std::endl;
+}
+
+template<typename Read>
+CaptureResult run(int count, Read read) {
+    CaptureResult result;
+    std::clock_t cpuStart = std::clock();
+    auto wallStart = std::chrono::steady_clock::now();
+    while (result.frames < count && read())
+        result.frames += 1;
+    if (result.frames > 0) {
+        result.cpuMs = clock_to_millisecs(std::clock() - cpuStart) / result.frames;
+        result.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count() / result.frames;
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    CameraConfig config;
+    config.source = argc > 1 ? argv[1] : "test";
+    config.fps = 30;
+    int count = argc > 2 ? std::atoi(argv[2]) : 300;
+    if (config.source == "csi") {
+        std::cerr << "The camera is not benchmarked; use test or a video file." << std::endl;
+        return 1;
+    }
+    FramePyramid pyramid;
+
+    // --- Single branch, as with --legacy-capture ---
+    std::string size = "width=(int)" + std::to_string(config.width) + ", height=(int)" + std::to_string(config.height);
+    std::string legacy = (config.source == "test"
+                          ? "videotestsrc is-live=true pattern=ball ! video/x-raw, " + size + ", framerate=(fraction)" + std::to_string(config.fps) + "/1"
+                          : "filesrc location=\"" + config.source + "\" ! decodebin ! videoscale ! video/x-raw, " + size)
+                         + " ! videoconvert ! video/x-raw, format=(string)BGR ! appsink max-buffers=1 drop=true";
+    cv::VideoCapture cap(legacy, cv::CAP_GSTREAMER);
+    cv::Mat frame;
+    CaptureResult single = run(count, [&]() -> bool {
+        cap >> frame;
+        if (frame.empty())
+            return false;
+        pyramid.build(frame);
+        sink = static_cast<float>(Network::make_blob(frame).total());
+        return true;
+    });
+    cap.release();
+
+    // --- Dual branch ---
+    DualCapture camera;
+    Frame slot;
+    CaptureResult dual;
+    if (camera.open(config)) {
+        dual = run(count, [&]() -> bool {
+            if (!camera.read(slot))
+                return false;
+            pyramid.build_from_gray(slot.gray);
+            sink = static_cast<float>(Network::make_blob(slot.image).total());
+            return true;
+        });
+        camera.close();
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << std::left << std::setw(10) << "capture" << std::right << std::setw(8) << "frames" << std::setw(14) << "cpu ms/frame"
+              << std::setw(12) << "fps" << std::endl;
+    print("single", single);
+    print("dual", dual);
+    std::cout << "Branches unpaired: " << camera.unmatched_count() << std::endl;
+    return 0;
+}
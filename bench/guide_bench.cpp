@@ -0,0 +1,281 @@
+// Microbenchmarks of the per-frame helpers and pipeline stages. Needs no camera, sensors or audio device: every input
+// is synthetic with a fixed seed, and the network benchmark is reported as skipped if the model cannot be loaded.
+// Each benchmark reports ns/op (median of REPETITIONS runs) and heap allocations/op; the results go to stdout as JSON
+// so runs can be compared commit to commit, a readable table goes to stderr.
+// Usage: guide_bench [--filter <substring>] [--min-ms <ms per run>] [prototxt] [caffemodel]
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <random>
+#include <boost/log/expressions.hpp>
+
+#include "net.h"
+#include "pyramid.h"
+#include "frame_analysis.h"
+#include "warning_scheduler.h"
+#include "usfs_master.h"
+
+// --- Allocation counting ---
+// malloc and friends are interposed for the whole process, so operator new, cv::fastMalloc and library code are all
+// counted, on every thread (the network runs on OpenCV's thread pool). glibc only.
+static std::atomic<uint64_t> allocations(0);
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+void* malloc(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+void* calloc(size_t count, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+void* realloc(void* pointer, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+void* memalign(size_t alignment, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+void* aligned_alloc(size_t alignment, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+int posix_memalign(void** pointer, size_t alignment, size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = __libc_memalign(alignment, size);
+    if (p == nullptr)
+        return ENOMEM;
+    *pointer = p;
+    return 0;
+}
+}
+
+// --- Runner ---
+struct BenchResult {
+    std::string name;
+    bool skipped = false;
+    std::string note;
+    uint64_t iterations = 0; // Per run
+    double nsPerOp = 0.0;
+    double allocationsPerOp = 0.0;
+};
+
+static const int REPETITIONS = 5;
+volatile float sink; // Keeps the compiler from dropping results
+
+BenchResult measure(const std::string& name, double minMs, const std::function<void()>& op) {
+    BenchResult result;
+    result.name = name;
+    op(); // Warm up caches and lazily sized buffers
+
+    // Double the iteration count until one run takes minMs
+    uint64_t iterations = 1;
+    for (;;) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; i++)
+            op();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (ms >= minMs || iterations >= (1ull << 30))
+            break;
+        iterations *= 2;
+    }
+
+    std::vector<double> runs;
+    runs.reserve(REPETITIONS); // Nothing but op() may allocate while counting
+    uint64_t allocated = allocations.load(std::memory_order_relaxed);
+    for (int r = 0; r < REPETITIONS; r++) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; i++)
+            op();
+        runs.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations);
+    }
+    allocated = allocations.load(std::memory_order_relaxed) - allocated;
+    std::sort(runs.begin(), runs.end());
+    result.iterations = iterations;
+    result.nsPerOp = runs[REPETITIONS / 2];
+    result.allocationsPerOp = static_cast<double>(allocated) / (static_cast<double>(iterations) * REPETITIONS);
+    return result;
+}
+
+BenchResult skipped(const std::string& name, const std::string& note) {
+    BenchResult result;
+    result.name = name;
+    result.skipped = true;
+    result.note = note;
+    return result;
+}
+
+std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20)
+            out += c;
+    }
+    return out + "\"";
+}
+
+// Stands in for the audio player: never busy, so every dispatch() plays the next pending warning
+class BenchAudioSink : public AudioSink {
+public:
+    void play_sample(int _s, int _c) {}
+    void set_volume(int _c, int _v) {}
+    bool is_playing(int _c) {
+        return false;
+    }
+};
+
+int main(int argc, char** argv) {
+    std::string filter;
+    double minMs = 200.0;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else if (std::string(argv[i]) == "--min-ms" && i + 1 < argc)
+            minMs = std::atof(argv[++i]);
+        else
+            positional.push_back(argv[i]);
+    }
+    std::string modelConfiguration = positional.size() > 0 ? positional[0] : "model/MobileNetSSDV2_deploy.prototxt";
+    std::string modelBinary = positional.size() > 1 ? positional[1] : "model/MobileNetSSDV2.caffemodel";
+    boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::warning);
+
+    // --- Fixed inputs ---
+    std::mt19937 rng(42);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    std::vector<float> window(15); // Vertical acceleration window of Main.cpp
+    for (float& x : window)
+        x = 9.81f + noise(rng);
+
+    cv::theRNG().state = 42;
+    cv::Mat frame(720, 1280, CV_8UC3);
+    cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(255));
+    FramePyramid pyramid;
+    pyramid.build(frame);
+
+    uint8_t registers[16]; // Quaternion block as read from the sensor (qx, qy, qz, qw)
+    const float quaternion[4] = {0.1825742f, 0.3651484f, 0.5477226f, 0.7302967f};
+    std::memcpy(registers, quaternion, sizeof(registers));
+
+    double clockMs = 0.0;
+    WarningScheduler warnings;
+    warnings.set_clock([&clockMs] { return clockMs; });
+    BenchAudioSink audio;
+    const int LOADED_WARNINGS = 16;
+
+    // --- Benchmarks ---
+    typedef std::function<BenchResult()> Bench;
+    std::vector<std::pair<std::string, Bench>> benches;
+    benches.push_back({"mean", [&] {
+        return measure("mean", minMs, [&] { sink = mean(window); });
+    }});
+    benches.push_back({"empirical_standard_deviation", [&] {
+        return measure("empirical_standard_deviation", minMs, [&] { sink = empirical_standard_deviation(window); });
+    }});
+    benches.push_back({"warning_contains", [&] {
+        // Duplicate check a rule pass makes per detection (was vector_contains on the warning queue)
+        for (int s = 0; s < LOADED_WARNINGS; s++)
+            warnings.post(s, s % 4);
+        int sample = 0;
+        BenchResult result = measure("warning_contains", minMs, [&] {
+            sink = warnings.contains(sample);
+            sample = (sample + 1) % WarningScheduler::MAX_SAMPLES;
+        });
+        warnings.clear();
+        return result;
+    }});
+    benches.push_back({"warning_dispatch", [&] {
+        // Load the queue, then drain it the way the main loop does (was process_warnings)
+        return measure("warning_dispatch", minMs, [&] {
+            clockMs += 1000.0; // Past every cooldown
+            for (int s = 0; s < LOADED_WARNINGS; s++)
+                warnings.post(s, s % 4, 500.0);
+            while (warnings.dispatch(&audio) >= 0) {}
+        });
+    }});
+    benches.push_back({"frame_pyramid_build", [&] {
+        return measure("frame_pyramid_build", minMs, [&] { pyramid.build(frame); });
+    }});
+    benches.push_back({"day_night_update", [&] {
+        // Was get_image_class on the frame's HSV grid
+        DayNightClassifier classifier;
+        double nowMs = 0.0;
+        return measure("day_night_update", minMs, [&] {
+            nowMs += 100.0;
+            sink = static_cast<float>(classifier.update(frame, nowMs));
+        });
+    }});
+    benches.push_back({"laplacian", [&] {
+        return measure("laplacian", minMs, [&] { sink = laplacian(pyramid); });
+    }});
+    benches.push_back({"uint32_reg_to_float", [&] {
+        int offset = 0;
+        return measure("uint32_reg_to_float", minMs, [&] {
+            sink = Usfs::uint32_reg_to_float(&registers[offset]);
+            offset = (offset + 4) & 15;
+        });
+    }});
+    benches.push_back({"quaternion_to_euler", [&] {
+        return measure("quaternion_to_euler", minMs, [&] {
+            float roll, pitch, yaw;
+            USFS::quaternionToEuler(quaternion[3], quaternion[0], quaternion[1], quaternion[2], roll, pitch, yaw);
+            sink = roll + pitch + yaw;
+        });
+    }});
+    benches.push_back({"network_detect", [&] {
+        Network mobilenet(modelConfiguration, modelBinary);
+        try {
+            mobilenet.initialize(false); // Default backend: autotuning would make runs incomparable
+        } catch (const cv::Exception&) {
+            return skipped("network_detect", "model not loadable: " + modelBinary);
+        }
+        return measure("network_detect", minMs, [&] { sink = static_cast<float>(mobilenet.detect(frame).rows); });
+    }});
+
+    std::vector<BenchResult> results;
+    std::cerr << std::fixed << std::setprecision(2);
+    std::cerr << std::left << std::setw(30) << "benchmark" << std::right << std::setw(16) << "ns/op" << std::setw(14) << "allocs/op" << std::endl;
+    for (auto& bench : benches) {
+        if (!filter.empty() && bench.first.find(filter) == std::string::npos)
+            continue;
+        BenchResult result = bench.second();
+        results.push_back(result);
+        std::cerr << std::left << std::setw(30) << result.name << std::right;
+        if (result.skipped)
+            std::cerr << "  skipped (" << result.note << ")" << std::endl;
+        else
+            std::cerr << std::setw(16) << result.nsPerOp << std::setw(14) << result.allocationsPerOp << std::endl;
+    }
+
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    std::cout << std::setprecision(3) << std::fixed;
+    std::cout << "{\n  \"context\": {\"date\": " << json_string(date) << ", \"compiler\": " << json_string(__VERSION__)
+              << ", \"repetitions\": " << REPETITIONS << ", \"min_ms\": " << minMs << "},\n  \"benchmarks\": [";
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        std::cout << (i ? "," : "") << "\n    {\"name\": " << json_string(r.name) << ", ";
+        if (r.skipped)
+            std::cout << "\"skipped\": true, \"note\": " << json_string(r.note) << "}";
+        else
+            std::cout << "\"skipped\": false, \"iterations\": " << r.iterations << ", \"ns_per_op\": " << r.nsPerOp
+                      << ", \"allocations_per_op\": " << r.allocationsPerOp << "}";
+    }
+    std::cout << "\n  ]\n}" << std::endl;
+    return 0;
+}
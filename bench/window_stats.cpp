@@ -0,0 +1,83 @@
+// Per-sample cost of the sliding-window statistics: std::vector with erase(begin()) plus the mean() and
+// empirical_standard_deviation() helpers from net.h, versus RingWindow, for the window sizes Main.cpp uses. The
+// full-statistics columns add min, max, median and slope: recomputed over the vector, and with OrderStatistics on.
+// Usage: bench_window [samples]
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+#include <random>
+
+#include "net.h"
+#include "ring_window.h"
+
+volatile double sink; // Keeps the compiler from dropping the statistics
+
+template<std::size_t N>
+void run(const std::vector<float>& input) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<float> window;
+    for (float x : input) {
+        window.push_back(x);
+        if (window.size() > N)
+            window.erase(window.begin());
+        sink = mean(window) + empirical_standard_deviation(window);
+    }
+    double vectorNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / input.size();
+
+    start = std::chrono::steady_clock::now();
+    std::vector<float> scratch;
+    window.clear();
+    for (float x : input) {
+        window.push_back(x);
+        if (window.size() > N)
+            window.erase(window.begin());
+        auto range = std::minmax_element(window.begin(), window.end());
+        scratch.assign(window.begin(), window.end());
+        std::nth_element(scratch.begin(), scratch.begin() + (scratch.size() - 1) / 2, scratch.end());
+        double n = static_cast<double>(window.size()), indexSum = 0.0;
+        for (std::size_t k = 0; k < window.size(); k++)
+            indexSum += k * window[k];
+        double indexTotal = n * (n - 1.0) / 2.0, indexSquares = (n - 1.0) * n * (2.0 * n - 1.0) / 6.0;
+        double slope = n > 1 ? (n * indexSum - indexTotal * std::accumulate(window.begin(), window.end(), 0.0)) / (n * indexSquares - indexTotal * indexTotal) : 0.0;
+        sink = mean(window) + empirical_standard_deviation(window) + *range.first + *range.second + scratch[(scratch.size() - 1) / 2] + slope;
+    }
+    double vectorAllNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / input.size();
+
+    start = std::chrono::steady_clock::now();
+    RingWindow<float, N> ring; // As configured in Main.cpp
+    for (float x : input) {
+        ring.push(x);
+        sink = ring.mean() + ring.standard_deviation();
+    }
+    double ringNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / input.size();
+
+    start = std::chrono::steady_clock::now();
+    RingWindow<float, N, true> ringAll;
+    for (float x : input) {
+        ringAll.push(x);
+        sink = ringAll.mean() + ringAll.standard_deviation() + ringAll.min() + ringAll.max() + ringAll.median() + ringAll.slope();
+    }
+    double ringAllNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / input.size();
+
+    std::cout << std::setw(6) << N << "  " << std::setw(20) << vectorNs << "  " << std::setw(18) << ringNs
+              << "  " << std::setw(24) << vectorAllNs << "  " << std::setw(22) << ringAllNs << "  " << std::setw(7) << vectorNs / ringNs
+              << "  " << std::setw(11) << vectorAllNs / ringAllNs << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::size_t samples = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+    // Fixed seed so every run feeds the same input
+    std::mt19937 rng(42);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    std::vector<float> input(samples);
+    for (std::size_t i = 0; i < samples; i++)
+        input[i] = 9.81f + noise(rng);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "window  vector_ns_per_sample  ring_ns_per_sample  vector_all_ns_per_sample  ring_all_ns_per_sample  speedup  speedup_all" << std::endl;
+    run<10>(input);  // Lidar distance
+    run<15>(input);  // Vertical acceleration
+    run<29>(input);  // Altitude slope
+    return 0;
+}
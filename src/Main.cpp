@@ -1,28 +1,79 @@
+#include <fstream>
 #include <iomanip>
+#include <sys/stat.h>
+#include <boost/core/null_deleter.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/log/expressions.hpp>
-#include <boost/log/utility/setup/file.hpp>
+#include <boost/log/sinks/async_frontend.hpp>
 #include <boost/log/utility/setup/common_attributes.hpp>
-#include <boost/log/utility/setup/console.hpp>
+#include <boost/log/utility/setup/formatter_parser.hpp>
 
 #include "net.h"
+#include "model_manager.h"
+#include "frame_buffer.h"
+#include "camera.h"
+#include "bounded_queue.h"
+#include "pyramid.h"
+#include "frame_analysis.h"
+#include "ring_window.h"
 #include "lidar.h"
 #include "audio.h"
 #include "usfs_master.h"
+#include "replay.h"
+#include "recorder.h"
+#include "warning_scheduler.h"
+#include "startup.h"
+#include "roi.h"
+#include "class_rules.h"
+#include "tracker.h"
+#include "inference_scheduler.h"
+#include "metrics.h"
+#include "metrics_exporter.h"
+#include "async_log.h"
 
 namespace logging = boost::log;
-namespace keywords = boost::log::keywords;
+namespace sinks = boost::log::sinks;
 
 // --- Create video capture object and global variables ---
-cv::VideoCapture cap(gstreamer_pipeline(1280, 720, 1280, 720, 10, 0), cv::CAP_GSTREAMER); //gstreamer_pipeline(1280, 720, 1280, 720, 10, 0), cv::CAP_GSTREAMER
-cv::Mat stream;
-bool stop = false;
-bool standby = false;
-enum class Imclass {Day, Night, None};
+cv::VideoCapture cap; // Opened in main() for replays, recordings and --legacy-capture
+DualCapture* camera = nullptr; // Opened in main() for live runs; captures into the frame slots without a copy
+FrameBuffer frames;
+std::atomic<bool> stop(false);
+std::atomic<bool> standby(false);
 
-std::vector<std::array<int, 4>> warnings;
-AudioPlayer* player = new AudioPlayer();
-LidarLite_v3* lidar = new LidarLite_v3();
-int distance_mean = 1000;
+// --- Pipeline stages and the queues between them ---
+// capture -> [FrameBuffer, newest frame wins] -> preprocess -> [preprocessed, drop oldest] -> inference -> [WarningScheduler] -> audio (main thread)
+// The inference thread posts alerts in frame order, but WarningScheduler plays them by priority (first posted wins a
+// tie) and lets those older than ALERT_TTL_MS expire: a stale obstacle warning is worse than none. It replaced a
+// blocking, frame-ordered results queue that never dropped an alert.
+struct FrameJob {
+    uint64_t sequence = 0;
+    cv::Size frameSize; // Size of the (possibly cropped) frame the blob was built from
+    cv::Rect region;    // Part of that frame the blob covers
+    bool sceneChange = false; // The scene changed abruptly since the last network pass
+    cv::Mat blob;       // Owns its data, so the camera slot can be recycled while inference runs
+};
+BoundedQueue<FrameJob> preprocessed(1, QueuePolicy::DropOldest); // Inference always works on the freshest frame
+std::atomic<bool> night(false);
+std::atomic<bool> moving(true);
+std::atomic<float> turn_rate(0.0f);
+std::atomic<float> gyro_rate(0.0f); // Magnitude of the angular rate, deg/s
+std::atomic<float> head_pitch(-75.0f); // Nodding angle; on this mounting the motion sensor reports it as roll
+InferenceRoi roi; // Configured in main() before the pipeline starts
+ClassRules class_rules; // Loaded in main() before the pipeline starts, then used by the inference thread only
+Tracker tracker;        // Configured in main() before the pipeline starts, then used by the inference thread only
+InferenceScheduler inference_scheduler; // Configured in main() before the pipeline starts, then used by the preprocessing thread only
+std::atomic<bool> camera_failed(false);
+const float BLUR_THRESHOLD = 40.0f; // Frames with a blur score at or below this are too blurred for inference
+
+WarningScheduler warnings; // Posted to by every stage, played by the main thread
+const double ALERT_TTL_MS = 2000.0; // An obstacle warning that could not be played within this time is outdated
+AudioSink* player = nullptr;
+RangeSensor* lidar = nullptr;
+ReplayClock* replay_clock = nullptr; // Only set in replay mode
+SessionRecorder* recorder = nullptr;  // Only set when recording a session
+StartupOrchestrator startup;          // Constructed before main(), so its clock covers the whole startup
+std::atomic<int> distance_mean(1000);
 
 static const uint8_t  MAG_RATE       = 100;  // Hz
 static const uint16_t ACCEL_RATE     = 200;  // Hz
@@ -30,143 +81,409 @@ static const uint16_t GYRO_RATE      = 200;  // Hz
 static const uint8_t  BARO_RATE      = 50;   // Hz
 static const uint8_t  Q_RATE_DIVISOR = 3;    // 1/3 gyro rate
 
+// Period of the main loop, the rate it used to get from the camera: the motion windows, the slope threshold and the
+// shutdown countdown below are counted in its iterations
+static const int MAIN_LOOP_MS = 100;
+
 // --- Define functions ---
+void capture_frame() {
+    // Fills the producer slot; an empty image tells the pipeline the camera failed
+    if (camera == nullptr) {
+        cap >> frames.back_buffer();
+        return;
+    }
+    Frame& slot = frames.back_slot();
+    if (!camera->read(slot))
+        slot = Frame();
+}
+
 void get_frame() {
     BOOST_LOG_TRIVIAL(info) << "Starting video thread...";
     while (!stop) { // Get constant video stream using separate thread
         if (!standby) {
-            cap >> stream;
+            {
+                StageTimer timer(Stage::Capture);
+                capture_frame();
+            }
+            Metrics::global().add(Counter::FramesCaptured);
+            if (recorder != nullptr)
+                recorder->record_frame(frames.back_buffer());
+            frames.publish();
             std::this_thread::sleep_for(std::chrono::nanoseconds(1));
         }
     }
-    BOOST_LOG_TRIVIAL(info) << "Received stop command; Stopping video thread.";
+    BOOST_LOG_TRIVIAL(info) << "Received stop command; Stopping video thread. Dropped " << frames.dropped_count() << " of " << frames.published_count() << " frames.";
+}
+
+void replay_frames() {
+    BOOST_LOG_TRIVIAL(info) << "Starting replay video thread...";
+    double fps = cap.get(cv::CAP_PROP_FPS);
+    if (fps <= 0.0)
+        fps = 10.0;
+    uint64_t index = 0;
+    
+    while (!stop) { // Frames are timestamped by their index so replays do not depend on container metadata
+        cv::Mat& slot = frames.back_buffer();
+        if (!cap.read(slot) || slot.empty()) {
+            replay_clock->end_of_video();
+            break;
+        }
+        if (!replay_clock->reach(index++ * 1000.0 / fps))
+            break;
+        if (standby) // Camera is off in standby
+            replay_clock->frame_done();
+        else
+            frames.publish();
+    }
+    BOOST_LOG_TRIVIAL(info) << "Stopping replay video thread after " << index << " frames.";
+}
+
+double pipeline_ms() {
+    // Time base of the pipeline stages: the simulated clock when replaying, the steady clock otherwise
+    return replay_clock != nullptr ? replay_clock->now() : WarningScheduler::steady_ms();
+}
+
+void frame_finished() {
+    // The pipeline is done with the current frame; lets a replay advance its clock
+    if (replay_clock != nullptr)
+        replay_clock->frame_done();
 }
 
 void measure_distance() {
     BOOST_LOG_TRIVIAL(info) << "Starting distance thread...";
-    std::vector<float> dist_vec;
+    RingWindow<float, 10, false> dist_window;
     float dist;
-    __u8  busyFlag;
-    unsigned int counter, divider = 0;
+    __u16 range;
+    // Beep interval by distance band; these match the cadence the former per-poll dividers (540/380/220) gave at the
+    // ~0.55 ms the status-polling loop took per iteration. 0 = continuous tone, -1 = silent
+    int beep_interval_ms = -1;
+    auto last_beep = std::chrono::steady_clock::now();
     while (!stop) {
         if (!standby) {
-            busyFlag = lidar->getBusyFlag();
-            if (busyFlag == 0x00) {
-                lidar->takeRange();
-                dist = static_cast<float>(lidar->readDistance());
+            if (lidar->next_distance(range)) {
+                Metrics::global().add(Counter::LidarReadings);
+                if (recorder != nullptr)
+                    recorder->record_lidar(range);
+                dist = static_cast<float>(range);
             
                 if (dist <= 1)
                     dist = 1000;
                 
-                dist_vec.push_back(dist);
-                if (dist_vec.size() > 10)
-                    dist_vec.erase(dist_vec.begin());
+                dist_window.push(dist);
             }
             
-            counter += 1;
-            int dist_mean = static_cast<int>(mean(dist_vec));
+            int dist_mean = dist_window.empty() ? 1000 : static_cast<int>(dist_window.mean());
             distance_mean = dist_mean;
         
             if (dist_mean < 300 && dist_mean > 225)
-                divider = 540;
+                beep_interval_ms = 300;
             if (dist_mean < 225 && dist_mean > 150)
-                divider = 380;
+                beep_interval_ms = 210;
             if (dist_mean < 150 && dist_mean > 75)
-                divider = 220;
+                beep_interval_ms = 120;
             if (dist_mean < 75)
-                divider = 1;
+                beep_interval_ms = 0;
             if (dist_mean > 300) {
-                divider = 0;
+                beep_interval_ms = -1;
             }
         
-            if (counter % divider == 0 && divider != 0) {
+            auto now = std::chrono::steady_clock::now();
+            if (beep_interval_ms >= 0 && now - last_beep >= std::chrono::milliseconds(beep_interval_ms)) {
                 if (!player->is_playing(1)) {
-                    if (divider == 1)
+                    if (beep_interval_ms == 0)
                         player->play_sample(LONG_BEEP, 1);
                     else
                         player->play_sample(SHORT_BEEP, 1);
+                    last_beep = now;
                 }
             }
             std::this_thread::sleep_for(std::chrono::nanoseconds(1));
         }
     }
     BOOST_LOG_TRIVIAL(info) << "Received stop command; Stopping distance thread.";
-    dist_vec.clear();
 }
 
-Imclass get_image_class(cv::Mat *img) {
-    cv::Mat dst, hsv;
-    int sum_val = 0, mean_val = 0;
+void preprocess_frames() {
+    BOOST_LOG_TRIVIAL(info) << "Starting preprocessing thread...";
+    DayNightClassifier day_night;
+    FramePyramid pyramid; // Reused every frame so its buffers are only allocated once
     
-    cv::resize(*img, dst, cv::Size(64, 35));
-    cv::cvtColor(dst, hsv, cv::COLOR_BGR2HSV);
-    for (int i = 0; i <= 15; i++) {
-        for (int j = 0; j < hsv.cols; j++) {
-            cv::Vec3b pixel = hsv.at<cv::Vec3b>(i, j);
-            sum_val += static_cast<int>(pixel.val[2]);
+    while (!stop) {
+        if (standby) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        if (!frames.wait_and_acquire(std::chrono::milliseconds(100)))
+            continue;
+        Metrics::global().record(Stage::FrameAge, frames.frame_age_ms() * 1000.0);
+        
+        // With a dual-branch capture, frame is at network resolution and gray holds the full-resolution luma;
+        // otherwise frame is the full-resolution BGR image. Crops and regions are in full-resolution coordinates.
+        const Frame& captured = frames.current();
+        cv::Mat frame = captured.image, gray = captured.gray;
+        cv::Size full = captured.size();
+        if (frame.empty()) {
+            camera_failed = true;
+            break;
+        }
+        
+        // --- Cropping unnecessary parts of the frame when turning ---
+        cv::Rect crop(0, 0, full.width, full.height);
+        float gy = turn_rate;
+        if (gy < -20.0f || gy > 20.0f) {
+            int x_left = 0;
+            int x_width = full.width;
+            if (gy < 0.0f) {
+                x_left += static_cast<int>(gy * 2) * -1;
+                x_width -= x_left + 1;
+            }
+            else
+                x_width -= static_cast<int>(gy * 2);
+            crop = cv::Rect(x_left, 0, x_width, full.height);
+            frame = frame(scale_rect(crop, full, frame.size()));
+            if (!gray.empty())
+                gray = gray(crop);
+        }
+        
+        // --- Image classification ---
+        {
+            StageTimer timer(Stage::ImageClass);
+            night = day_night.update(frame, pipeline_ms()) == Imclass::Night;
+        }
+        
+        // --- Blur detection (night frames never reach inference, so they are not preprocessed or scored) ---
+        float lap = 0.0f;
+        if (!night) {
+            if (gray.empty())
+                pyramid.build(frame); // Shared with the inference scheduler
+            else
+                pyramid.build_from_gray(gray);
+            StageTimer timer(Stage::Laplacian);
+            // The scheduler compares exact scores; without it only the threshold decision matters. The score is a
+            // variance, so limited-range luma is scaled back to the full-range threshold by the squared gain
+            float gain2 = captured.grayGain * captured.grayGain;
+            lap = gain2 * laplacian(pyramid, inference_scheduler.enabled() ? 0.0f : BLUR_THRESHOLD / gain2);
+        }
+        
+        // --- Hand sharp day frames to the inference stage, unless the scheduler finds nothing new in them ---
+        bool infer = !night && lap > BLUR_THRESHOLD;
+        InferenceDecision decision = InferenceDecision::Run;
+        if (infer) {
+            decision = inference_scheduler.decide(pyramid.levels.back(), lap, gyro_rate, moving, pipeline_ms());
+            infer = decision == InferenceDecision::Run || decision == InferenceDecision::SceneChange;
+            if (!infer)
+                Metrics::global().add(Counter::InferenceSkips);
+        }
+        if (infer) {
+            FrameJob job;
+            job.sequence = frames.current().sequence;
+            job.sceneChange = decision == InferenceDecision::SceneChange;
+            job.frameSize = crop.size();
+            job.region = roi.region(job.frameSize, head_pitch);
+            job.blob = Network::make_blob(frame(scale_rect(job.region, job.frameSize, frame.size())));
+            preprocessed.push(std::move(job));
         }
+        else
+            frame_finished();
     }
-    mean_val = sum_val / (16 * hsv.cols);
-    
-    if (mean_val < 90) 
-        return Imclass::Night;
-    else
-        return Imclass::Day;
+    LatencyHistogram age;
+    Metrics::global().histogram(Stage::FrameAge, age);
+    BOOST_LOG_TRIVIAL(info) << "Received stop command; Stopping preprocessing thread. Dropped " << preprocessed.dropped_count() << " preprocessed frames; "
+                            << "frame age on acquire mean " << age.mean_us() / 1000.0 << " ms, p99 " << age.percentile_us(0.99) / 1000.0
+                            << " ms, max " << age.max_us() / 1000.0 << " ms.";
+    inference_scheduler.log_stats();
 }
 
-float laplacian(cv::Mat *fr) {
-    cv::Scalar m, stdv;
-    cv::Mat gray, lap;
-
-    cv::cvtColor(*fr, gray, cv::COLOR_BGR2GRAY);
-    cv::Laplacian(gray, lap, CV_64F);
-    cv::meanStdDev(lap, m, stdv, cv::Mat());
-
-    return static_cast<float>(std::pow(stdv.val[0], 2));
-}
-
-void process_warnings() {
-    int max_val = 0, max = -1, del = -1;
-
-    for (std::size_t i = 0; i < warnings.size(); i++) {
-        if (warnings[i][3] > max_val && warnings[i][1] == 0) { // Find warning with highest priority
-            max_val = warnings[i][3];
-            max = i;
+void run_inference(ModelManager* mobilenet) {
+    BOOST_LOG_TRIVIAL(info) << "Starting inference thread...";
+    cv::Mat detections;
+    std::vector<TrackedDetection> found;
+    uint64_t passes = 0, skipped = 0;
+    
+    while (!stop) {
+        // --- Pause or resume the resident network when switching between day and night or standby ---
+        mobilenet->set_active(!standby && !night);
+        
+        FrameJob job;
+        if (!preprocessed.pop(job, std::chrono::milliseconds(100)))
+            continue;
+        if (!mobilenet->is_active()) {
+            tracker.clear();
+            frame_finished();
+            continue;
         }
-        if (warnings[i][1] == 1) // Iterate counter
-            warnings[i][2] += 1;
-        if (warnings[i][2] > 10) // When counter full, mark as 'to be removed'
-            del = i;
-    }
-
-    if (max != -1) { // Play warning and mark as played
-        if (!player->is_playing(0)) {
-            player->play_sample(warnings[max][0], 0);
-            warnings[max][1] = 1;
+        uint8_t conditions = ClassRules::conditions(distance_mean <= 500, moving);
+        
+        // --- Between network passes, warn from the predicted tracks ---
+        if (tracker.enabled() && !tracker.should_detect() && !job.sceneChange) {
+            {
+                StageTimer timer(Stage::RulePass);
+                tracker.predict(pipeline_ms());
+                class_rules.evaluate(tracker.tracks(), job.frameSize, conditions, warnings, ALERT_TTL_MS);
+                class_rules.end_frame();
+            }
+            skipped += 1;
+            frame_finished();
+            continue;
+        }
+        
+        // --- Object detection ---
+        {
+            StageTimer timer(Stage::Detect);
+            detections = mobilenet->detect_blob(job.blob);
+        }
+        startup.first_detection();
+        Metrics::global().add(Counter::NetworkPasses);
+        if (EventLog::global().is_enabled()) {
+            for (int i = 0; i < detections.rows; i++) {
+                const float* row = detections.ptr<float>(i); // image, class, confidence, x1, y1, x2, y2
+                EventLog::global().emit(EventType::Detection, {row[1], row[2], row[3], row[4], row[5], row[6]});
+            }
         }
+        passes += 1;
+        
+        {
+            StageTimer timer(Stage::RulePass);
+            if (tracker.enabled()) {
+                class_rules.collect(detections, job.region, found);
+                tracker.update(found, pipeline_ms());
+                class_rules.evaluate(tracker.tracks(), job.frameSize, conditions, warnings, ALERT_TTL_MS);
+            } else {
+                class_rules.evaluate(detections, job.region, job.frameSize, conditions, warnings, ALERT_TTL_MS);
+            }
+            class_rules.end_frame();
+        }
+        
+        frame_finished();
     }
+    BOOST_LOG_TRIVIAL(info) << "Received stop command; Stopping inference thread. " << passes << " network passes, " << skipped << " frames tracked only.";
+}
+
+// --- Logging: records go through a lock-free ring to a writer thread; no thread ever waits on the file or terminal ---
+typedef sinks::asynchronous_sink<CoalescingBackend, RingLogQueue<1024>> LogSink;
+boost::shared_ptr<LogSink> log_sink;
 
-    if (del != -1) // Remove warning from vector
-        warnings.erase(warnings.begin() + del);
+void shutdown_logging() {
+    if (!log_sink)
+        return;
+    logging::core::get()->remove_sink(log_sink);
+    log_sink->stop();
+    log_sink->flush(); // Writes what the ring still holds and any coalesced repeats
+    if (log_sink->dropped_count() > 0)
+        std::cout << "[log] " << log_sink->dropped_count() << " records dropped on a full ring" << std::endl;
+    log_sink.reset();
 }
 
 void init_logging() {
     logging::register_simple_formatter_factory<logging::trivial::severity_level, char>("Severity");
-    logging::add_file_log(keywords::file_name = "log/runtime.log", keywords::format = "[%TimeStamp%] [%ThreadID%] [%Severity%] %Message%");
-    logging::add_console_log(std::cout, keywords::format = "[%TimeStamp%] [%ThreadID%] [%Severity%] %Message%");
+    mkdir("log", 0755);
+    boost::shared_ptr<CoalescingBackend> backend = boost::make_shared<CoalescingBackend>();
+    boost::shared_ptr<std::ofstream> file = boost::make_shared<std::ofstream>("log/runtime.log", std::ios::app);
+    if (file->is_open())
+        backend->add_stream(file);
+    backend->add_stream(boost::shared_ptr<std::ostream>(&std::cout, boost::null_deleter()));
+    log_sink = boost::make_shared<LogSink>(backend);
+    log_sink->set_formatter(logging::parse_formatter("[%TimeStamp%] [%ThreadID%] [%Severity%] %Message%"));
+    logging::core::get()->add_sink(log_sink);
     logging::core::get()->set_filter(logging::trivial::severity >= logging::trivial::info);
     logging::add_common_attributes();
+    std::atexit(shutdown_logging);
 }
 
 // --- MAIN FUNCTION ---
 int main(int argc, char** argv) {
     init_logging();
+    
+    // --- Offline replay: main --replay <video> <imu log> <lidar log> [--realtime] [--out <warnings file>] ---
+    // --- Session recording: main --record <file prefix> ---
+    // --- Free-running lidar: main --lidar-burst <Hz> (0 = sensor default rate) ---
+    // --- Audio output buffer: main --audio-buffer <frames> (256 to 4096, default 512) ---
+    // --- ROI inference: main --roi <margin> [--roi-band <height fraction>] ---
+    // --- Detection rules: main --rules <file> (see class_rules.h for the format) ---
+    // --- Tracking: main --detect-every <N> (run the network on every Nth frame, predict tracks in between) ---
+    // --- Adaptive inference: main --adaptive-inference (skip static and motion-blurred frames) ---
+    // --- Metrics: main --metrics <file> [--metrics-port <port>] (Prometheus text, every 5 s / on localhost) ---
+    // --- Binary event log: main --event-log <file> (BinaryEvent records, see async_log.h) ---
+    // --- Capture: main --camera <csi|test|video file> (default csi) | --legacy-capture (single BGR branch) ---
+    bool replay = argc >= 5 && std::string(argv[1]) == "--replay";
+    bool replay_realtime = false;
+    int lidar_burst_hz = -1;
+    int audio_buffer_frames = 512;
+    RoiConfig roi_config;
+    CameraConfig camera_config;
+    bool legacy_capture = false;
+    TrackerConfig tracker_config;
+    SchedulerConfig scheduler_config;
+    std::string metrics_file;
+    int metrics_port = 0;
+    std::string replay_out, record_prefix;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--realtime")
+            replay_realtime = true;
+        else if (std::string(argv[i]) == "--out" && i + 1 < argc)
+            replay_out = argv[++i];
+        else if (std::string(argv[i]) == "--record" && i + 1 < argc)
+            record_prefix = argv[++i];
+        else if (std::string(argv[i]) == "--lidar-burst" && i + 1 < argc)
+            lidar_burst_hz = std::atoi(argv[++i]);
+        else if (std::string(argv[i]) == "--audio-buffer" && i + 1 < argc)
+            audio_buffer_frames = std::atoi(argv[++i]);
+        else if (std::string(argv[i]) == "--roi" && i + 1 < argc) {
+            roi_config.enabled = true;
+            roi_config.margin = std::atof(argv[++i]);
+        } else if (std::string(argv[i]) == "--roi-band" && i + 1 < argc)
+            roi_config.band = std::atof(argv[++i]);
+        else if (std::string(argv[i]) == "--rules" && i + 1 < argc)
+            class_rules.load(argv[++i]);
+        else if (std::string(argv[i]) == "--detect-every" && i + 1 < argc)
+            tracker_config.detectInterval = std::max(1, std::atoi(argv[++i]));
+        else if (std::string(argv[i]) == "--adaptive-inference")
+            scheduler_config.enabled = true;
+        else if (std::string(argv[i]) == "--metrics" && i + 1 < argc)
+            metrics_file = argv[++i];
+        else if (std::string(argv[i]) == "--metrics-port" && i + 1 < argc)
+            metrics_port = std::atoi(argv[++i]);
+        else if (std::string(argv[i]) == "--event-log" && i + 1 < argc)
+            EventLog::global().open(argv[++i]);
+        else if (std::string(argv[i]) == "--camera" && i + 1 < argc)
+            camera_config.source = argv[++i];
+        else if (std::string(argv[i]) == "--legacy-capture")
+            legacy_capture = true;
+    }
+    MetricsExporter metrics_exporter;
+    if (!metrics_file.empty() || metrics_port > 0)
+        metrics_exporter.start(metrics_file, 5000.0, metrics_port);
+    tracker = Tracker(tracker_config);
+    inference_scheduler = InferenceScheduler(scheduler_config);
+    roi = InferenceRoi(roi_config);
+    std::ofstream replay_file;
+    ReplayMotionSensor* replay_imu = nullptr;
+    
+    if (replay) {
+        BOOST_LOG_TRIVIAL(info) << "Replaying " << argv[2] << (replay_realtime ? " in real time" : " as fast as possible") << "...";
+        if (!replay_out.empty())
+            replay_file.open(replay_out);
+        replay_clock = new ReplayClock(replay_realtime, &standby);
+        warnings.set_clock([] { return replay_clock->now(); });
+        player = new NullAudioPlayer(replay_clock, replay_file.is_open() ? replay_file : std::cout);
+        lidar = new ReplayLidar(argv[4], replay_clock);
+        replay_imu = new ReplayMotionSensor(argv[3]);
+    } else {
+        player = new AudioPlayer(audio_buffer_frames);
+        lidar = new LidarLite_v3();
+    }
+    if (!record_prefix.empty()) {
+        recorder = new SessionRecorder();
+        if (!recorder->open(record_prefix)) {
+            delete recorder;
+            recorder = nullptr;
+        }
+    }
     player->set_volume(0, MIX_MAX_VOLUME);
     player->set_volume(1, MIX_MAX_VOLUME);
     
     // --- Play startup sequence ---
     player->play_sample(STARTUP_SEQUENCE, 0);
-    std::this_thread::sleep_for(std::chrono::seconds(13));
     
     std::cout << std::fixed;
     std::cout << std::setprecision(2);
@@ -176,37 +493,73 @@ int main(int argc, char** argv) {
     std::string modelBinary = "model/MobileNetSSDV2.caffemodel";
     bool quit = false;
     
-    Network* mobilenet = new Network(modelConfiguration, modelBinary);
-    mobilenet->initialize();
-    cv::Mat detections;
-    int trafficlight_switch = -1, trafficlight_counter = 0;
-    Imclass image_class_prev = Imclass::Day, image_class_edge = Imclass::None;
-    unsigned int image_class_counter = 0;
-    float lap = 0.0f;
+    ModelManager* mobilenet = new ModelManager(modelConfiguration, modelBinary);
+    bool night_prev = false;
     
-    USFS* motion_sen = new USFS(MAG_RATE, ACCEL_RATE, GYRO_RATE, BARO_RATE, Q_RATE_DIVISOR);
-    std::vector<float> az_list;
-    std::vector<float> alt_list_prev;
-    std::vector<float> alt_list_new;
+    MotionSensor* motion_sen = replay ? static_cast<MotionSensor*>(replay_imu) : new USFS(MAG_RATE, ACCEL_RATE, GYRO_RATE, BARO_RATE, Q_RATE_DIVISOR);
+    RingWindow<float, 15, false> az_window;  // 1.5 s at MAIN_LOOP_MS
+    RingWindow<float, 29, false> alt_window; // Spans the two overlapping 15-sample windows the slope used to be taken between
     bool register_gesture = false;
-    bool moving = true;
     bool on_slope = false;
     int shutdown_counter = -1;
     
-    // --- Terminate program if encountering an error
-    bool lidar_state = lidar->i2c_init(), usfs_state = motion_sen->begin(0), cap_state = cap.isOpened();
-    if (!lidar_state || !usfs_state || !cap_state) {
-        if (!lidar_state)
-            BOOST_LOG_TRIVIAL(error) << "Failed initializing lidar sensor; Aborting.";
-        if (!usfs_state) {
-            BOOST_LOG_TRIVIAL(error) << motion_sen->getErrorString();
-            BOOST_LOG_TRIVIAL(error) << "Failed initializing motion sensor; Aborting.";
+    // --- Bring up model, sensors and camera concurrently while the announcements play ---
+    startup.launch("model", [mobilenet]() -> bool {
+        mobilenet->load(); // Loaded and warmed up once; day/night and standby only pause it
+        return true;
+    });
+    startup.launch("motion sensor", [motion_sen]() -> bool {
+        if (motion_sen->begin(0))
+            return true;
+        BOOST_LOG_TRIVIAL(error) << motion_sen->getErrorString();
+        BOOST_LOG_TRIVIAL(error) << "Failed initializing motion sensor.";
+        return false;
+    });
+    startup.launch("lidar", []() -> bool {
+        if (lidar->i2c_init())
+            return true;
+        BOOST_LOG_TRIVIAL(error) << "Failed initializing lidar sensor.";
+        return false;
+    });
+    // Recordings store the full BGR frames, so they (and replays of them) keep the single-branch capture
+    bool dual_capture = !replay && !legacy_capture && record_prefix.empty();
+    // The ROI is cropped from the network branch, so it is delivered larger than the network input
+    camera_config.networkSize = roi_config.enabled ? cv::Size(640, 360) : cv::Size(300, 300);
+    std::string video_source = replay ? std::string(argv[2]) : gstreamer_pipeline(1280, 720, 1280, 720, 10, 0);
+    startup.launch("camera", [replay, dual_capture, camera_config, video_source]() -> bool {
+        if (dual_capture) {
+            camera = new DualCapture();
+            if (camera->open(camera_config))
+                return true;
+            BOOST_LOG_TRIVIAL(error) << "Failed to open video source.";
+            return false;
         }
-        if (!cap_state)
-            BOOST_LOG_TRIVIAL(error) << "Failed to open video source; Aborting.";
+        if (replay)
+            cap.open(video_source);
+        else
+            cap.open(video_source, cv::CAP_GSTREAMER);
+        if (cap.isOpened())
+            return true;
+        BOOST_LOG_TRIVIAL(error) << "Failed to open video source.";
+        return false;
+    });
+    
+    // A replay has no announcements to wait for: its audio only advances with the replay clock
+    auto voice_idle = [replay] { return replay || !player->is_playing(0); };
+    
+    // --- Play startup warning message as soon as the sequence ends, unless a step already failed
+    startup.wait_until([voice_idle] { return startup.failed() || voice_idle(); });
+    if (!startup.failed())
+        player->play_sample(STARTUP_WARNING, 0);
+    
+    // --- Terminate program if encountering an error
+    if (!startup.wait_all()) {
+        BOOST_LOG_TRIVIAL(error) << "Startup failed; Aborting.";
         
         stop = true;
         cap.release();
+        delete camera;
+        camera = nullptr;
         
         delete mobilenet;       // Delete MobileNet
         mobilenet = nullptr;
@@ -216,33 +569,69 @@ int main(int argc, char** argv) {
         lidar = nullptr;
         delete player;          // Delete audio player
         player = nullptr;
+        delete replay_clock;
+        replay_clock = nullptr;
+        delete recorder;
+        recorder = nullptr;
         
-        system("sudo /bin/sh -c shutdown -h now");
+        EventLog::global().close();
+        shutdown_logging();
+        if (!replay)
+            system("sudo /bin/sh -c shutdown -h now");
         return -1;
     }
-    cap >> stream;
-    std::thread videoThread(get_frame);
+    startup.mark("model, sensors and camera ready");
     
-    // --- Play startup warning message
-    player->play_sample(STARTUP_WARNING, 0);
-    std::this_thread::sleep_for(std::chrono::seconds(15));
+    // --- Start the pipeline while the warning message is still playing, so the first frame is through the
+    // network by the time the start signal sounds
+    if (!replay && lidar_burst_hz >= 0)
+        static_cast<LidarLite_v3*>(lidar)->start_burst(lidar_burst_hz);
+    if (!replay) { // A replay releases its first frame through the replay clock
+        capture_frame();
+        frames.publish();
+    }
+    std::thread videoThread(replay ? replay_frames : get_frame);
+    std::thread distanceThread(measure_distance);
+    std::thread preprocessThread(preprocess_frames);
+    std::thread inferenceThread(run_inference, mobilenet);
     
     // --- Play start signal
+    startup.wait_until(voice_idle);
     player->play_sample(SIGN_START, 0);
-    std::thread distanceThread(measure_distance);
+    startup.mark("start signal");
     
-    // --- MAIN LOOP ---
+    // --- MAIN LOOP: motion sensor and warning stage ---
+    float roll = 0.0f, pitch = 0.0f, yaw = 0.0f;
+    float ax = 0.0f, ay = 0.0f, az = 0.0f;
+    float gx = 0.0f, gy = 0.0f, gz = 0.0f;
+    float mx = 0.0f, my = 0.0f, mz = 0.0f;
+    float pressure = 1013.25f, temperature = 20.0f, altitude = 0.0f;
+    auto next_tick = std::chrono::steady_clock::now();
     for (;;) {
-        cv::Mat frame = stream;
+        // --- Replay: advance the simulated clock to the next logged motion sample ---
+        if (replay && (!replay_imu->next() || !replay_clock->advance_to(replay_imu->timestamp_ms())))
+            break;
+        // --- Live: one iteration every MAIN_LOOP_MS; a late iteration does not make the next ones catch up ---
+        if (!replay) {
+            next_tick += std::chrono::milliseconds(static_cast<int>(MAIN_LOOP_MS));
+            auto now = std::chrono::steady_clock::now();
+            if (next_tick < now)
+                next_tick = now;
+            else
+                std::this_thread::sleep_until(next_tick);
+        }
         
         // --- Check for errors
-        if (frame.empty()) {
+        if (camera_failed) {
             BOOST_LOG_TRIVIAL(error) << "Failed to get frame image from video source; Aborting.";
             player->play_sample(ERROR_CAM, 0);
             std::this_thread::sleep_for(std::chrono::seconds(6));
             break;
         }
-        motion_sen->checkEventStatus();            
+        {
+            StageTimer timer(Stage::ImuRead);
+            motion_sen->checkEventStatus();
+        }
         if (motion_sen->gotError()) {
             BOOST_LOG_TRIVIAL(error) << motion_sen->getErrorString();
             BOOST_LOG_TRIVIAL(error) << "Above error occured whilst checking motion sensor status; Aborting.";
@@ -251,17 +640,20 @@ int main(int argc, char** argv) {
             break;
         }
         
-        // --- PHASE 1: Collect data ---
-        float roll, pitch, yaw;
+        // --- PHASE 1: Collect data (latest sample of every sensor; fresh ones arrived since the last iteration) ---
         motion_sen->Quaternion(roll, pitch, yaw);
-        float ax, ay, az;
         motion_sen->Accelerometer(ax, ay, az);
-        float gx, gy, gz;
         motion_sen->Gyroscope(gx, gy, gz);
-        float mx, my, mz;
+        if (motion_sen->isFresh(MotionSensor::GYROSCOPE)) {
+            turn_rate = gy;
+            gyro_rate = std::sqrt(gx * gx + gy * gy + gz * gz);
+        }
+        if (motion_sen->isFresh(MotionSensor::QUATERNION))
+            head_pitch = roll;
         motion_sen->Magnetometer(mx, my, mz);
-        float temperature, pressure, altitude;
         motion_sen->Barometer(pressure, temperature, altitude);
+        if (recorder != nullptr)
+            recorder->record_imu({roll, pitch, yaw, ax, ay, az, gx, gy, gz, mx, my, mz, pressure, temperature, altitude, motion_sen->getEventStatus()});
         
         // --- PHASE 2: Process data ---
         
@@ -278,16 +670,12 @@ int main(int argc, char** argv) {
                 if (temp % 5 != 0)
                     temp = temp + 5 - (temp % 5);
                 
-                if (!vector_contains(warnings, hour + 5))
-                    warnings.push_back({hour + 5, 0, 0, 112});
-                if (!vector_contains(warnings, (temp / 5) + 22))
-                    warnings.push_back({(temp / 5) + 22, 0, 0, 111});
+                warnings.post(hour + 5, 112);
+                warnings.post((temp / 5) + 22, 111);
                 if (pressure > 800.0f) {
-                    if (!vector_contains(warnings, RAIN_NO))
-                        warnings.push_back({RAIN_NO, 0, 0, 110});
+                    warnings.post(RAIN_NO, 110);
                 } else {
-                    if (!vector_contains(warnings, RAIN_YES))
-                        warnings.push_back({RAIN_YES, 0, 0, 110});
+                    warnings.post(RAIN_YES, 110);
                 }
                 
                 register_gesture = false;
@@ -296,30 +684,22 @@ int main(int argc, char** argv) {
             if (register_gesture) {
                 if (standby) {
                     standby = false;
-                    mobilenet = new Network(modelConfiguration, modelBinary);
-                    mobilenet->initialize();
-                    if (!vector_contains(warnings, STANDBY_OFF))
-                        warnings.push_back({STANDBY_OFF, 0, 0, 900});
+                    warnings.post(STANDBY_OFF, 900);
                 } else {
                     standby = true;
-                    mobilenet = nullptr;
                     
-                    if (!vector_contains(warnings, STANDBY_ON))
-                        warnings.push_back({STANDBY_ON, 0, 0, 910});
+                    warnings.post(STANDBY_ON, 910);
                 }
                 register_gesture = false;
             }
         } else if (!standby && roll < -140.0f && pitch < 30.0f && pitch > -30.0f) { // Tilt down
-            if (register_gesture && !vector_contains(warnings, FALLING)) {
-                warnings.push_back({FALLING, 0, 0, 610});
+            if (register_gesture && warnings.post(FALLING, 610))
                 register_gesture = false;
-            }
         } else if (!standby && roll > -10.0f && pitch < 30.0f && pitch > -30.0f) { // Tilt up
             if (register_gesture) {
                 if (shutdown_counter == -1) {
-                    if (!vector_contains(warnings, SHUTDOWN_CONF))
-                        warnings.push_back({SHUTDOWN_CONF, 0, 0, 999});
-                    shutdown_counter = 600;
+                    warnings.post(SHUTDOWN_CONF, 999);
+                    shutdown_counter = 60000 / MAIN_LOOP_MS; // One minute to confirm
                 } else {
                     quit = true;
                 }
@@ -332,197 +712,86 @@ int main(int argc, char** argv) {
             shutdown_counter -= 1;
             
         // --- Detect walking ---
-        az_list.push_back(az);
-        if (az_list.size() > 15)
-            az_list.erase(az_list.begin());
+        if (motion_sen->isFresh(MotionSensor::ACCELEROMETER))
+            az_window.push(az);
             
-        if (empirical_standard_deviation(az_list) < 0.1f)
+        if (az_window.standard_deviation() < 0.1f)
             moving = false;
         
-        if (!moving) {
-            if (az_list[14] > 0.3f)
+        if (!moving && !az_window.empty()) {
+            if (az_window.newest() > 0.3f)
                 moving = true;
         }
         
         // --- Detect slopes ---
-        if (!standby) {
-            alt_list_new.push_back(altitude);
-            if (alt_list_new.size() > 15)
-                alt_list_new.erase(alt_list_new.begin());
-            alt_list_prev.push_back(alt_list_new[0]);
-            if (alt_list_prev.size() > 15)
-                alt_list_prev.erase(alt_list_prev.begin());
+        if (!standby && motion_sen->isFresh(MotionSensor::BAROMETER)) {
+            alt_window.push(altitude);
             
-            float slope = (mean(alt_list_new) - mean(alt_list_prev)) / (float)alt_list_new.size();
+            float slope = static_cast<float>(alt_window.slope()); // Altitude change per sample, i.e. per MAIN_LOOP_MS
             if (slope > 0.02f) {
                 if (!on_slope) {
-                    if (!vector_contains(warnings, WARN_UPHILL))
-                        warnings.push_back({WARN_UPHILL, 0, 0, 200});
+                    warnings.post(WARN_UPHILL, 200);
                     on_slope = true;
                 }
             }
             else if (slope < -0.02f) {
                 if (!on_slope) {
-                    if (!vector_contains(warnings, WARN_DOWNHILL))
-                        warnings.push_back({WARN_DOWNHILL, 0, 0, 210});
+                    warnings.post(WARN_DOWNHILL, 210);
                     on_slope = true;
                 }
             }
             else if (on_slope)
                 on_slope = false;
-        
-        
-        // --- Cropping unnecessary parts of the frame when turning ---
-            if (gy < -20.0f || gy > 20.0f) {
-                cv::Mat frame_cr;
-                int x_left = 0;
-                int x_width = frame.size().width;
-                if (gy < 0.0f) {
-                    x_left += static_cast<int>(gy * 2) * -1;
-                    x_width -= x_left + 1;
-                }
-                else
-                    x_width -= static_cast<int>(gy * 2);
-                frame_cr = frame(cv::Rect(x_left, 0, x_width, 720));
-                frame = frame_cr;
-            }
-        
-        // --- Image classification ---
-            Imclass image_class = get_image_class(&frame);
-            if (image_class != image_class_prev && image_class_counter == 0) {
-                image_class_counter += 1;
-                image_class_edge = image_class;
-            }
-            if (image_class_counter != 0)
-                image_class_counter += 1;
-            if (image_class_counter == 7) {
-                if (image_class == image_class_edge) {
-                    if (image_class == Imclass::Day) {
-                        if (!vector_contains(warnings, TO_DAY))
-                            warnings.push_back({TO_DAY, 0, 0, 150});
-                        mobilenet = new Network(modelConfiguration, modelBinary);
-                        mobilenet->initialize();
-                    }
-                    if (image_class == Imclass::Night) {
-                        if (!vector_contains(warnings, TO_NIGHT))
-                            warnings.push_back({TO_NIGHT, 0, 0, 151});
-                        mobilenet = nullptr;
-                    }
-                }
-                image_class_counter = 0;
-                image_class_edge = Imclass::None;
-            }
-            image_class_prev = image_class;
-        
-        // --- Blur detection ---
-            lap = laplacian(&frame);
         }
         
-        // --- Object detection ---
-        if (mobilenet != nullptr && lap > 40.0f) {
-            detections = mobilenet->detect(frame);
-            
-            for (int i = 0; i < detections.rows; i++) {
-                float confidence = detections.at<float>(i, 2);
-            
-                if (confidence > 0.3f) {
-                    int objectClass = static_cast<int>(detections.at<float>(i, 1));
-                    if (objectClass == 0)
-                        continue;
-                    int xLeftBottom = static_cast<int>(detections.at<float>(i, 3) * frame.cols);
-                    int yLeftBottom = static_cast<int>(detections.at<float>(i, 4) * frame.rows);
-                    int xRightTop = static_cast<int>(detections.at<float>(i, 5) * frame.cols);
-                    int yRightTop = static_cast<int>(detections.at<float>(i, 6) * frame.rows);
-                    float d = (int)std::sqrt(std::pow(xRightTop - xLeftBottom, 2) + std::pow(yLeftBottom - yRightTop, 2));
-                    cv::Point m((int)((xLeftBottom + xRightTop) / 2), (int)((yLeftBottom + yRightTop) / 2));
-                    std::cout << d << std::endl;
-                    if (m.x < 0.3f * frame.size().width || m.x > 0.7f * frame.size().width)
-                        continue;
-                    
-                    switch (objectClass) {
-                        case 1: { // Person
-                            if (d > 500.0f && distance_mean <= 500 && !vector_contains(warnings, WARN_PERSON))
-                                warnings.push_back({WARN_PERSON, 0, 0, 300});
-                        } break;
-                        case 2: { // Bicycle
-                            if (d > 400.0f && !vector_contains(warnings, WARN_BICYCLE))
-                                warnings.push_back({WARN_BICYCLE, 0, 0, 400});
-                        } break;
-                        case 3: { // Car
-                            if (d > 600.0f && distance_mean <= 500 && moving && !vector_contains(warnings, WARN_CAR))
-                                warnings.push_back({WARN_CAR, 0, 0, 500});
-                        } break;
-                        case 4: { // Motorcycle
-                            if (d > 550.0f && moving && !vector_contains(warnings, WARN_MOTORCYCLE))
-                                warnings.push_back({WARN_MOTORCYCLE, 0, 0, 350});
-                        } break;
-                        case 5: { // Bus
-                            if (d > 700.0f && distance_mean <= 500 && moving && !vector_contains(warnings, WARN_BUS))
-                                warnings.push_back({WARN_BUS, 0, 0, 325});
-                        } break;
-                        case 6: { // Bench
-                            if (d > 350.0f && d < 600.0f && !vector_contains(warnings, SUGG_BENCH))
-                                warnings.push_back({SUGG_BENCH, 0, 0, 90});
-                        } break;
-                        case 7: { // Chair
-                            if (d > 300.0f && d < 500.0f && !vector_contains(warnings, SUGG_CHAIR))
-                                warnings.push_back({SUGG_CHAIR, 0, 0, 80});
-                        } break;
-                        case 8: { // Bin
-                            if (d > 300.0f && d < 600.0f && !vector_contains(warnings, SUGG_BIN))
-                                warnings.push_back({SUGG_BIN, 0, 0, 100});
-                        } break;
-                        case 9: { // Red traffic light
-                            if (d > 100.0f && d < 300.0f && !moving) {
-                                if (trafficlight_switch == -1 && !vector_contains(warnings, WARN_LIGHTRED))
-                                    warnings.push_back({WARN_LIGHTRED, 0, 0, 600});
-                                trafficlight_switch = 0;
-                                trafficlight_counter = 1;
-                            }
-                        } break;
-                        case 10: { // Green traffic light
-                            if (trafficlight_switch == 0 && d > 100.0f && d < 300.0f && !moving && !vector_contains(warnings, WARN_LIGHTGREEN)) {
-                                warnings.push_back({WARN_LIGHTGREEN, 0, 0, 550});
-                                trafficlight_switch = 1;
-                            }
-                        } break;
-                    }
-                }
-            }
-            
-            if (trafficlight_counter != 0)
-                trafficlight_counter += 1;
-            if (trafficlight_counter == 30) {
-                trafficlight_counter = 0;
-                trafficlight_switch = -1;
-            }
-            
-            //mobilenet->draw_detections(frame);
+        // --- Announce day/night transitions detected by the preprocessing stage ---
+        bool is_night = night;
+        if (is_night != night_prev) {
+            if (!is_night)
+                warnings.post(TO_DAY, 150);
+            if (is_night)
+                warnings.post(TO_NIGHT, 151);
+            night_prev = is_night;
         }
         
-        
-        
         /*cv::imshow("GUIDE-Walk v2.0", frame);
         if (cv::waitKey(10) == 99)
             break;*/
         if (quit)
             break;
         
-        process_warnings();
+        {
+            StageTimer timer(Stage::WarningDispatch);
+            if (warnings.dispatch(player) >= 0)
+                Metrics::global().add(Counter::WarningsPlayed);
+        }
     }
     
     stop = true;
+    if (replay) {
+        replay_clock->log_summary();
+        replay_clock->stop();
+    }
+    preprocessed.close();
+    preprocessThread.join();
+    inferenceThread.join();
     distanceThread.join();
     player->play_sample(SHUTDOWN, 1);
-    std::this_thread::sleep_for(std::chrono::seconds(7));
+    if (!replay)
+        std::this_thread::sleep_for(std::chrono::seconds(7));
     
     // --- End all processes ---
     videoThread.join();
     cap.release();
+    if (camera != nullptr)
+        BOOST_LOG_TRIVIAL(info) << "Capture delivered " << camera->unmatched_count() << " frames with unpaired branches.";
+    delete camera;
+    camera = nullptr;
+    delete recorder;        // Flushes queued records
+    recorder = nullptr;
+    I2CBus::log_all_stats();
+    metrics_exporter.stop(); // Writes the final snapshot
     warnings.clear();
-    az_list.clear();
-    alt_list_new.clear();
-    alt_list_prev.clear();
     
     delete mobilenet;       // Delete MobileNet
     mobilenet = nullptr;
@@ -532,7 +801,12 @@ int main(int argc, char** argv) {
     lidar = nullptr;
     delete player;          // Delete audio player
     player = nullptr;
+    delete replay_clock;
+    replay_clock = nullptr;
+    EventLog::global().close();
+    shutdown_logging();     // Drains the log ring
     
-    system("sudo /bin/sh -c shutdown -h now"); // Shut down Jetson Nano
+    if (!replay)
+        system("sudo /bin/sh -c shutdown -h now"); // Shut down Jetson Nano
     return 0;
 }
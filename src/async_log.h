@@ -0,0 +1,338 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions/message.hpp>
+#include <boost/log/sinks/basic_sink_backend.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/shared_ptr.hpp>
+
+// --- Logging off the hot path ---
+// Log records are handed to a dedicated writer thread through a bounded lock-free ring: producers never wait for the
+// writer, and when the ring is full the record is dropped and counted rather than blocking the caller. The writer
+// coalesces repeated messages and rate-limits chatty severities before anything reaches the file or the terminal.
+// High-frequency data goes through EventLog instead, as fixed-size binary records.
+
+// Bounded multi-producer ring (sequence-numbered cells after D. Vyukov); try_push() and try_pop() never block, a
+// full ring makes try_push() fail.
+template<typename T, std::size_t N>
+class LogRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "LogRing capacity must be a power of two");
+private:
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+    Cell cells[N];
+    alignas(64) std::atomic<std::size_t> enqueuePos;
+    alignas(64) std::atomic<std::size_t> dequeuePos;
+public:
+    LogRing() : enqueuePos(0), dequeuePos(0) {
+        for (std::size_t i = 0; i < N; i++)
+            this->cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool try_push(const T& value) {
+        std::size_t pos = this->enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = this->cells[pos & (N - 1)];
+            std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (this->enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) { // Full
+                return false;
+            } else {
+                pos = this->enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    bool try_pop(T& value) {
+        std::size_t pos = this->dequeuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = this->cells[pos & (N - 1)];
+            std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (this->dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.value = T(); // Release what the cell held (a log record is reference counted)
+                    cell.sequence.store(pos + N, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) { // Empty
+                return false;
+            } else {
+                pos = this->dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+// Queueing strategy for boost::log::sinks::asynchronous_sink backed by a LogRing. Records that find the ring full
+// are dropped; the writer thread polls the ring while it is empty.
+template<std::size_t N>
+class RingLogQueue {
+private:
+    LogRing<boost::log::record_view, N> ring;
+    std::atomic<bool> interrupted;
+    std::atomic<uint64_t> dropped;
+
+    static const int IDLE_POLL_US = 2000;
+protected:
+    RingLogQueue() : interrupted(false), dropped(0) {}
+    template<typename ArgsT>
+    explicit RingLogQueue(const ArgsT&) : interrupted(false), dropped(0) {}
+
+    void enqueue(const boost::log::record_view& record) {
+        // The core calls this after try_enqueue() failed; only here is the record given up
+        if (!this->ring.try_push(record))
+            this->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    bool try_enqueue(const boost::log::record_view& record) {
+        return this->ring.try_push(record);
+    }
+    bool try_dequeue_ready(boost::log::record_view& record) {
+        return this->ring.try_pop(record);
+    }
+    bool try_dequeue(boost::log::record_view& record) {
+        return this->ring.try_pop(record);
+    }
+    bool dequeue_ready(boost::log::record_view& record) {
+        while (!this->interrupted.load(std::memory_order_acquire)) {
+            if (this->ring.try_pop(record))
+                return true;
+            std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long>(IDLE_POLL_US)));
+        }
+        this->interrupted.store(false, std::memory_order_release);
+        return false;
+    }
+    void interrupt_dequeue() {
+        this->interrupted.store(true, std::memory_order_release);
+    }
+public:
+    uint64_t dropped_count() const {
+        return this->dropped.load(std::memory_order_relaxed);
+    }
+};
+
+// Writes formatted records to any number of streams. Runs on the writer thread only, so it needs no locking.
+//   Coalescing: a message seen again within COALESCE_MS of its first occurrence is swallowed; the next occurrence
+//               after the window is printed with the number of repeats it stood for.
+//   Rate limit: info and below are limited to INFO_PER_SECOND lines (token bucket); warnings and errors always pass.
+class CoalescingBackend : public boost::log::sinks::basic_formatted_sink_backend<char, boost::log::sinks::synchronized_feeding> {
+private:
+    static const int COALESCE_MS = 1000;
+    static const int INFO_PER_SECOND = 50;
+    static const std::size_t MAX_TRACKED = 256; // Distinct messages remembered for coalescing
+
+    struct Seen {
+        std::chrono::steady_clock::time_point first;
+        uint64_t repeats = 0;
+    };
+    std::vector<boost::shared_ptr<std::ostream>> streams;
+    std::unordered_map<std::string, Seen> seen;
+    double tokens = INFO_PER_SECOND;
+    std::chrono::steady_clock::time_point refilled = std::chrono::steady_clock::now();
+    uint64_t limited = 0;
+
+    void write(const std::string& line) {
+        for (auto& stream : this->streams) {
+            *stream << line << '\n';
+            stream->flush();
+        }
+    }
+    void write_repeats(const std::string& message, uint64_t repeats) {
+        if (repeats > 0)
+            write("[log] \"" + message + "\" repeated " + std::to_string(repeats) + " more times");
+    }
+    void evict(std::chrono::steady_clock::time_point now) {
+        // Makes room in a full table: forget every message whose window has passed, or else the oldest one; repeats
+        // still held back are written first
+        auto oldest = this->seen.end();
+        for (auto it = this->seen.begin(); it != this->seen.end();) {
+            if (now - it->second.first >= std::chrono::milliseconds(static_cast<long>(COALESCE_MS))) {
+                write_repeats(it->first, it->second.repeats);
+                it = this->seen.erase(it);
+                continue;
+            }
+            if (oldest == this->seen.end() || it->second.first < oldest->second.first)
+                oldest = it;
+            ++it;
+        }
+        if (this->seen.size() >= MAX_TRACKED && oldest != this->seen.end()) {
+            write_repeats(oldest->first, oldest->second.repeats);
+            this->seen.erase(oldest);
+        }
+    }
+public:
+    void add_stream(const boost::shared_ptr<std::ostream>& stream) {
+        this->streams.push_back(stream);
+    }
+
+    void consume(const boost::log::record_view& record, const string_type& formatted) {
+        auto now = std::chrono::steady_clock::now();
+        auto message = record[boost::log::expressions::smessage];
+        auto severity = record[boost::log::trivial::severity];
+        bool chatty = !severity || severity.get() < boost::log::trivial::warning;
+
+        std::string repeated;
+        if (message) {
+            if (this->seen.size() >= MAX_TRACKED && this->seen.find(message.get()) == this->seen.end())
+                evict(now);
+            auto inserted = this->seen.emplace(message.get(), Seen());
+            Seen& entry = inserted.first->second;
+            if (!inserted.second && now - entry.first < std::chrono::milliseconds(static_cast<long>(COALESCE_MS))) {
+                entry.repeats += 1;
+                return;
+            }
+            if (entry.repeats > 0)
+                repeated = " (repeated " + std::to_string(entry.repeats) + " times)";
+            entry.first = now;
+            entry.repeats = 0;
+        }
+
+        if (chatty) {
+            this->tokens += std::chrono::duration<double>(now - this->refilled).count() * INFO_PER_SECOND;
+            this->refilled = now;
+            if (this->tokens > INFO_PER_SECOND)
+                this->tokens = INFO_PER_SECOND;
+            if (this->tokens < 1.0) {
+                this->limited += 1;
+                return;
+            }
+            this->tokens -= 1.0;
+        }
+        if (this->limited > 0) {
+            write("[log] " + std::to_string(this->limited) + " messages suppressed by the rate limit");
+            this->limited = 0;
+        }
+        write(formatted + repeated);
+    }
+    void flush() {
+        // Called on shutdown: repeats still held back by the coalescing window would otherwise be lost
+        for (auto& entry : this->seen) {
+            write_repeats(entry.first, entry.second.repeats);
+            entry.second.repeats = 0;
+        }
+        if (this->limited > 0)
+            write("[log] " + std::to_string(this->limited) + " messages suppressed by the rate limit");
+        this->limited = 0;
+        for (auto& stream : this->streams)
+            stream->flush();
+    }
+};
+
+// --- Binary structured events ---
+// Fixed-size records for data too frequent for text logging. emit() is a lock-free ring push; a writer thread
+// appends the records to the file in batches. Disabled (emit() returns at once) until open() succeeded.
+enum class EventType : uint16_t {Detection = 1, ImuMissing = 2, Warning = 3};
+
+struct BinaryEvent {
+    uint64_t timeNs;  // steady_clock
+    uint16_t type;
+    uint16_t count;   // Values used
+    uint32_t reserved;
+    float values[6];
+};
+static_assert(sizeof(BinaryEvent) == 40, "BinaryEvent is a fixed on-disk record");
+
+class EventLog {
+private:
+    static const std::size_t CAPACITY = 4096;
+    static const int IDLE_POLL_MS = 5;
+
+    LogRing<BinaryEvent, CAPACITY> ring;
+    std::atomic<bool> enabled;
+    std::atomic<bool> running;
+    std::atomic<uint64_t> dropped;
+    FILE* file = nullptr;
+    std::thread writer;
+
+    void run() {
+        std::vector<BinaryEvent> batch;
+        batch.reserve(256);
+        BinaryEvent event;
+        for (;;) {
+            bool stopping = !this->running.load(std::memory_order_acquire);
+            while (batch.size() < 256 && this->ring.try_pop(event))
+                batch.push_back(event);
+            if (!batch.empty()) {
+                fwrite(batch.data(), sizeof(BinaryEvent), batch.size(), this->file);
+                batch.clear();
+                continue;
+            }
+            if (stopping)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int>(IDLE_POLL_MS)));
+        }
+        fflush(this->file);
+    }
+public:
+    EventLog() : enabled(false), running(false), dropped(0) {}
+    EventLog(const EventLog&) = delete;
+    EventLog& operator=(const EventLog&) = delete;
+    ~EventLog() {
+        close();
+    }
+    static EventLog& global() {
+        static EventLog instance;
+        return instance;
+    }
+
+    bool open(const std::string& path) {
+        this->file = fopen(path.c_str(), "wb");
+        if (this->file == nullptr) {
+            BOOST_LOG_TRIVIAL(error) << "Unable to open event log " << path;
+            return false;
+        }
+        this->running = true;
+        this->writer = std::thread(&EventLog::run, this);
+        this->enabled = true;
+        return true;
+    }
+    void close() {
+        if (!this->enabled.exchange(false))
+            return;
+        this->running = false;
+        this->writer.join();
+        if (this->dropped > 0)
+            BOOST_LOG_TRIVIAL(warning) << "Event log dropped " << this->dropped << " events.";
+        fclose(this->file);
+        this->file = nullptr;
+    }
+
+    bool is_enabled() const {
+        return this->enabled.load(std::memory_order_relaxed);
+    }
+    void emit(EventType type, std::initializer_list<float> values) {
+        if (!is_enabled())
+            return;
+        BinaryEvent event;
+        event.timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        event.type = static_cast<uint16_t>(type);
+        event.count = 0;
+        event.reserved = 0;
+        for (float v : values) {
+            if (event.count == 6)
+                break;
+            event.values[event.count++] = v;
+        }
+        for (int i = event.count; i < 6; i++)
+            event.values[i] = 0.0f;
+        if (!this->ring.try_push(event))
+            this->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+};
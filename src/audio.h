@@ -1,5 +1,7 @@
 #pragma once
 #include <string>
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <chrono>
 #include <thread>
@@ -12,6 +14,9 @@
 #include <boost/log/core.hpp>
 #include <boost/log/trivial.hpp>
 
+#include "metrics.h"
+#include "pcm_pack.h"
+
 #define NUM_WAVEFORMS 41
 
 #define STARTUP_SEQUENCE    0
@@ -44,7 +49,17 @@
 #define SHORT_BEEP          39
 #define LONG_BEEP           40
 
-class AudioPlayer {
+// Audio output as used by the warning logic, so a replay can log warnings instead of playing them
+class AudioSink {
+public:
+    virtual ~AudioSink() {}
+    
+    virtual void play_sample(int _s, int _c) = 0;
+    virtual void set_volume(int _c, int _v) = 0;
+    virtual bool is_playing(int _c) = 0;
+};
+
+class AudioPlayer : public AudioSink {
 private:
     const char _waveFileNames[NUM_WAVEFORMS][40] = {"audio/startup_seq.wav", "audio/startup_warning.wav", 
                                         "audio/start_signal.wav", "audio/warning_person.wav",
@@ -63,9 +78,104 @@ private:
                                         "audio/error_camera.wav", "audio/error_usfs.wav", "audio/error_lidar.wav",
                                         "audio/confirm_shutdown.wav", "audio/shutdown.wav",
                                         "audio/short_beep.wav", "audio/long_beep.wav"};
-    Mix_Chunk* _sample[NUM_WAVEFORMS];
+    static const int NUM_CHANNELS = 2;
+    static const int FREQUENCY = 44100;
+
+    Mix_Chunk* _sample[NUM_WAVEFORMS] = {};
+    bool _missing[NUM_WAVEFORMS] = {};
+    PcmPack _pack;
+    bool _fromPack = false;
+    int _frequency = FREQUENCY;
+    int _bufferFrames;
+
+    // Play request -> first mix of the sample, per channel; written by play_sample(), consumed by the mixer thread
+    std::atomic<int64_t> _requestedNs[NUM_CHANNELS];
+    std::atomic<uint64_t> _latencyCount{0};
+    std::atomic<uint64_t> _latencyTotalUs{0};
+    std::atomic<uint64_t> _latencyMaxUs{0};
+
+    static int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    static bool is_rare(int _s) {
+        // Voice lines spoken once per session or on request: startup, clock (18-23), temperature (24-29), rain,
+        // standby, errors and shutdown. They are decoded or mapped on first play instead of at startup.
+        return _s <= SIGN_START || (_s >= 18 && _s <= 29) || (_s >= RAIN_YES && _s <= SHUTDOWN);
+    }
+    static void post_mix(void* udata, Uint8*, int) {
+        static_cast<AudioPlayer*>(udata)->on_mixed();
+    }
+    void on_mixed() {
+        // Mix_PlayChannel() holds the audio lock, so a sample requested before this callback is part of this buffer
+        int64_t now = now_ns();
+        for (int c = 0; c < NUM_CHANNELS; c++) {
+            int64_t requested = this->_requestedNs[c].exchange(0);
+            if (requested == 0)
+                continue;
+            uint64_t us = static_cast<uint64_t>((now - requested) / 1000);
+            Metrics::global().record(Stage::AudioStart, static_cast<double>(us));
+            this->_latencyCount += 1;
+            this->_latencyTotalUs += us;
+            uint64_t seen = this->_latencyMaxUs.load();
+            while (us > seen && !this->_latencyMaxUs.compare_exchange_weak(seen, us)) {}
+        }
+    }
+
+    Mix_Chunk* chunk(int _s) {
+        if (this->_sample[_s] != NULL || this->_missing[_s])
+            return this->_sample[_s];
+        if (this->_fromPack) // Points into the mapping; nothing is decoded or copied
+            this->_sample[_s] = Mix_QuickLoad_RAW(this->_pack.data(_s), this->_pack.length(_s));
+        else
+            this->_sample[_s] = Mix_LoadWAV(this->_waveFileNames[_s]);
+        if (this->_sample[_s] == NULL) {
+            BOOST_LOG_TRIVIAL(error) << "Unable to load wave file: " << this->_waveFileNames[_s];
+            this->_missing[_s] = true;
+        }
+        return this->_sample[_s];
+    }
+    bool open_pack(const std::string& packPath) {
+        int frequency, channels;
+        Uint16 format;
+        if (!Mix_QuerySpec(&frequency, &format, &channels) || !this->_pack.open(packPath))
+            return false;
+        if (!this->_pack.matches(frequency, format, channels, NUM_WAVEFORMS)) {
+            this->_pack.close();
+            return false;
+        }
+        for (int i = 0; i < NUM_WAVEFORMS; i++) {
+            if (!this->_pack.is_current(i, this->_waveFileNames[i])) {
+                this->_pack.close();
+                return false;
+            }
+        }
+        return true;
+    }
+    void build_pack(const std::string& packPath) {
+        // Decode every WAV file into the output format once and keep the result for the next start
+        int frequency, channels;
+        Uint16 format;
+        Mix_QuerySpec(&frequency, &format, &channels);
+        std::vector<const uint8_t*> pcm(NUM_WAVEFORMS, nullptr);
+        std::vector<uint32_t> lengths(NUM_WAVEFORMS, 0);
+        std::vector<std::string> sources(NUM_WAVEFORMS);
+        for (int i = 0; i < NUM_WAVEFORMS; i++) {
+            sources[i] = this->_waveFileNames[i];
+            if (chunk(i) != NULL) {
+                pcm[i] = this->_sample[i]->abuf;
+                lengths[i] = this->_sample[i]->alen;
+            }
+        }
+        if (PcmPack::write(packPath, frequency, format, channels, pcm, lengths, sources))
+            BOOST_LOG_TRIVIAL(info) << "Wrote audio pack " << packPath << ".";
+        else
+            BOOST_LOG_TRIVIAL(warning) << "Unable to write audio pack " << packPath << "; decoding WAV files on every start.";
+    }
 public:
-    AudioPlayer() {
+    static const int MIN_BUFFER_FRAMES = 256;
+    static const int MAX_BUFFER_FRAMES = 4096;
+
+    AudioPlayer(int bufferFrames = 512, const std::string& packPath = "audio/voice.pack") {
         BOOST_LOG_TRIVIAL(info) << "Constructing audio player class...";
         
         if (Mix_Init(MIX_INIT_FLAC | MIX_INIT_MP3 | MIX_INIT_OGG) < 0) {
@@ -74,34 +184,60 @@ public:
             exit(-1);
         }
         
-        memset(this->_sample, 0, sizeof(Mix_Chunk*) * 2);
+        // The output buffer bounds the play latency: one buffer is mixed ahead of the one the device is playing
+        this->_bufferFrames = MIN_BUFFER_FRAMES;
+        while (this->_bufferFrames < bufferFrames && this->_bufferFrames < MAX_BUFFER_FRAMES)
+            this->_bufferFrames *= 2;
+        for (int c = 0; c < NUM_CHANNELS; c++)
+            this->_requestedNs[c] = 0;
 
-        if(Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 1024) < 0) {
+        if(Mix_OpenAudio(FREQUENCY, MIX_DEFAULT_FORMAT, 2, this->_bufferFrames) < 0) {
             BOOST_LOG_TRIVIAL(error) << Mix_GetError();
             BOOST_LOG_TRIVIAL(error) << "Unable to open audio player; Aborting.";
             exit(-1);
         }
         
-        Mix_AllocateChannels(2);
-        
-        for(int i = 0; i < NUM_WAVEFORMS; i++) {
-            this->_sample[i] = Mix_LoadWAV(this->_waveFileNames[i]);
-            if(this->_sample[i] == NULL) {
-                BOOST_LOG_TRIVIAL(error) << "Unable to load wave file: " << this->_waveFileNames[i];
+        Mix_AllocateChannels(NUM_CHANNELS);
+        int channels;
+        Uint16 format;
+        Mix_QuerySpec(&this->_frequency, &format, &channels);
+        BOOST_LOG_TRIVIAL(info) << "Audio output: " << this->_frequency << " Hz, " << this->_bufferFrames << " frame buffer ("
+                                << this->buffer_ms() << " ms).";
+
+        this->_fromPack = open_pack(packPath);
+        if (this->_fromPack) {
+            // Mapping is free; page in the warnings now so their first play does not wait for the disk
+            for (int i = 0; i < NUM_WAVEFORMS; i++) {
+                if (!is_rare(i)) {
+                    this->_pack.prefault(i);
+                    chunk(i);
+                }
             }
+        } else {
+            build_pack(packPath);
         }
+        Mix_SetPostMix(post_mix, this);
     }
     ~AudioPlayer() {
         BOOST_LOG_TRIVIAL(info) << "Destructing audio player class...";
+        Mix_SetPostMix(NULL, NULL);
+        uint64_t count = this->_latencyCount.load();
+        if (count > 0) {
+            BOOST_LOG_TRIVIAL(info) << "Audio play latency over " << count << " samples: mean " << this->mean_latency_ms()
+                                    << " ms, max " << this->_latencyMaxUs.load() / 1000.0 << " ms until mixed, plus "
+                                    << this->buffer_ms() << " ms output buffer.";
+        }
+        Mix_CloseAudio();
         for(int i = 0; i < NUM_WAVEFORMS; i++) {
             Mix_FreeChunk(this->_sample[i]);
         }
-        Mix_CloseAudio();
         Mix_Quit();
     }
     
     void play_sample(int _s, int _c) {
-        Mix_PlayChannel(_c, this->_sample[_s], 0);
+        if (_c >= 0 && _c < NUM_CHANNELS)
+            this->_requestedNs[_c] = now_ns();
+        Mix_PlayChannel(_c, chunk(_s), 0);
     }
     void set_volume(int _c, int _v) {
         Mix_Volume(_c, _v);
@@ -109,4 +245,14 @@ public:
     bool is_playing(int _c) {
         return Mix_Playing(_c);
     }
+
+    // --- Latency ---
+    double buffer_ms() const {
+        return 1000.0 * this->_bufferFrames / this->_frequency;
+    }
+    double mean_latency_ms() const {
+        // Play request until the sample was mixed into an output buffer; add buffer_ms() for the time until it is heard
+        uint64_t count = this->_latencyCount.load();
+        return count ? this->_latencyTotalUs.load() / 1000.0 / count : 0.0;
+    }
 };
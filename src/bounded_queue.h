@@ -0,0 +1,97 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+// What push() does when the queue is full
+enum class QueuePolicy {
+    Block,      // Wait for the consumer (backpressure); nothing is lost
+    DropOldest  // Evict the oldest element so the consumer always gets the freshest data
+};
+
+// Fixed-capacity FIFO handing work from one pipeline stage to the next. FIFO order is kept for every element
+// that is not dropped, so downstream stages see items in the order they were produced.
+template <typename T>
+class BoundedQueue {
+private:
+    std::deque<T> items;
+    std::size_t capacity;
+    QueuePolicy policy;
+    bool closed = false;
+    uint64_t dropped = 0;
+    std::size_t highWater = 0;
+
+    mutable std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+public:
+    BoundedQueue(std::size_t capacity, QueuePolicy policy) : capacity(capacity), policy(policy) {}
+
+    bool push(T&& item) {
+        // Returns false once the queue was closed
+        std::unique_lock<std::mutex> lock(this->mutex);
+        if (this->policy == QueuePolicy::Block)
+            this->notFull.wait(lock, [this] { return this->closed || this->items.size() < this->capacity; });
+        if (this->closed)
+            return false;
+
+        if (this->items.size() >= this->capacity) {
+            this->items.pop_front();
+            this->dropped += 1;
+        }
+        this->items.push_back(std::move(item));
+        if (this->items.size() > this->highWater)
+            this->highWater = this->items.size();
+        lock.unlock();
+        this->notEmpty.notify_one();
+        return true;
+    }
+    bool try_pop(T& item) {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        if (this->items.empty())
+            return false;
+        item = std::move(this->items.front());
+        this->items.pop_front();
+        lock.unlock();
+        this->notFull.notify_one();
+        return true;
+    }
+    bool pop(T& item, std::chrono::milliseconds timeout) {
+        // Waits up to timeout for an element; returns false on timeout or when closed and drained
+        std::unique_lock<std::mutex> lock(this->mutex);
+        if (!this->notEmpty.wait_for(lock, timeout, [this] { return this->closed || !this->items.empty(); }))
+            return false;
+        if (this->items.empty())
+            return false;
+        item = std::move(this->items.front());
+        this->items.pop_front();
+        lock.unlock();
+        this->notFull.notify_one();
+        return true;
+    }
+    void close() {
+        // Wake every blocked producer and consumer, e.g. on shutdown
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->closed = true;
+        }
+        this->notEmpty.notify_all();
+        this->notFull.notify_all();
+    }
+
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->items.size();
+    }
+    std::size_t high_water() const {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->highWater;
+    }
+    uint64_t dropped_count() const {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->dropped;
+    }
+};
@@ -0,0 +1,248 @@
+#pragma once
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+#include <opencv2/core.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+
+#include "frame_buffer.h"
+
+// --- Dual-branch capture ---
+// One GStreamer pipeline, split by a tee right after the source, feeding two appsinks:
+//   analysis  full-resolution NV12, of which only the Y plane is used: the gray image for blur scoring and the
+//             inference scheduler, without a color conversion
+//   network   BGR, already scaled to the network input (or to a size the ROI can be cropped from)
+// Both branches are pulled from their appsinks and matched by timestamp; the Mats point straight into the mapped
+// GStreamer buffers, which the frame slot keeps alive (Frame::owner) until the producer reuses it.
+// Sources: the CSI camera (nvarguscamerasrc, converted on the VIC by nvvidconv), videotestsrc and video files, so
+// the capture can be exercised without the camera.
+
+struct CameraConfig {
+    std::string source = "csi"; // "csi", "test" (videotestsrc) or the path of a video file
+    int width = 1280;           // Capture (analysis) resolution
+    int height = 720;
+    int fps = 10;
+    int flipMethod = 0;         // nvvidconv flip-method, CSI only
+    cv::Size networkSize = cv::Size(300, 300);
+};
+
+// Maps a rectangle between two resolutions of the same frame
+inline cv::Rect scale_rect(const cv::Rect& rect, const cv::Size& from, const cv::Size& to) {
+    if (from == to)
+        return rect;
+    int x0 = rect.x * to.width / from.width, y0 = rect.y * to.height / from.height;
+    int x1 = (rect.x + rect.width) * to.width / from.width, y1 = (rect.y + rect.height) * to.height / from.height;
+    return cv::Rect(x0, y0, std::max(1, x1 - x0), std::max(1, y1 - y0));
+}
+
+// A pulled sample, mapped for reading for as long as the object lives
+class MappedSample {
+private:
+    GstSample* sample;
+    GstBuffer* buffer;
+    GstMapInfo map;
+    bool mapped = false;
+public:
+    explicit MappedSample(GstSample* sample) : sample(sample), buffer(gst_sample_get_buffer(sample)) {
+        this->mapped = this->buffer != nullptr && gst_buffer_map(this->buffer, &this->map, GST_MAP_READ);
+    }
+    MappedSample(const MappedSample&) = delete;
+    MappedSample& operator=(const MappedSample&) = delete;
+    ~MappedSample() {
+        if (this->mapped)
+            gst_buffer_unmap(this->buffer, &this->map);
+        gst_sample_unref(this->sample);
+    }
+
+    GstClockTime pts() const {
+        return this->buffer != nullptr ? GST_BUFFER_PTS(this->buffer) : GST_CLOCK_TIME_NONE;
+    }
+    bool limited_range() const {
+        GstVideoInfo info;
+        return gst_video_info_from_caps(&info, gst_sample_get_caps(this->sample))
+               && GST_VIDEO_INFO_COLORIMETRY(&info).range == GST_VIDEO_COLOR_RANGE_16_235;
+    }
+    cv::Mat plane(int plane, int type) const {
+        // View of one plane (stride and offset from the buffer's video meta if it has one, else from the caps)
+        if (!this->mapped)
+            return cv::Mat();
+        GstVideoInfo info;
+        if (!gst_video_info_from_caps(&info, gst_sample_get_caps(this->sample)))
+            return cv::Mat();
+        int width = GST_VIDEO_INFO_WIDTH(&info), height = GST_VIDEO_INFO_HEIGHT(&info);
+        gsize offset = GST_VIDEO_INFO_PLANE_OFFSET(&info, plane);
+        gint stride = GST_VIDEO_INFO_PLANE_STRIDE(&info, plane);
+        GstVideoMeta* meta = gst_buffer_get_video_meta(this->buffer);
+        if (meta != nullptr) {
+            offset = meta->offset[plane];
+            stride = meta->stride[plane];
+        }
+        if (offset + static_cast<gsize>(stride) * (height - 1) + width * CV_ELEM_SIZE(type) > this->map.size)
+            return cv::Mat();
+        return cv::Mat(height, width, type, this->map.data + offset, stride);
+    }
+};
+
+class DualCapture {
+private:
+    struct Samples { // What a frame slot holds on to
+        std::unique_ptr<MappedSample> network, analysis;
+    };
+
+    GstElement* pipeline = nullptr;
+    GstAppSink* networkSink = nullptr;
+    GstAppSink* analysisSink = nullptr;
+    uint64_t unmatched = 0;
+
+    static const int PULL_MS = 100;       // Bus check interval while waiting for a frame
+    static const int STALL_MS = 5000;     // No frame for this long counts as a failed camera
+    static const int MAX_MATCH_PULLS = 8; // Pulls spent pairing the branches before the closest pair is used
+
+    bool bus_failed() {
+        // Logs and reports an error or the end of a file source
+        GstBus* bus = gst_element_get_bus(this->pipeline);
+        GstMessage* message = gst_bus_pop_filtered(bus, static_cast<GstMessageType>(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+        gst_object_unref(bus);
+        if (message == nullptr)
+            return false;
+        if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) {
+            GError* error = nullptr;
+            gchar* debug = nullptr;
+            gst_message_parse_error(message, &error, &debug);
+            BOOST_LOG_TRIVIAL(error) << "Capture pipeline error: " << (error != nullptr ? error->message : "unknown");
+            if (error != nullptr)
+                g_error_free(error);
+            g_free(debug);
+        } else {
+            BOOST_LOG_TRIVIAL(info) << "Capture source reached its end.";
+        }
+        gst_message_unref(message);
+        return true;
+    }
+    MappedSample* pull(GstAppSink* sink) {
+        // Waits for the next sample of a branch; nullptr on error, end of stream or a stalled source
+        auto start = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(static_cast<int>(STALL_MS))) {
+            GstSample* sample = gst_app_sink_try_pull_sample(sink, static_cast<GstClockTime>(PULL_MS) * GST_MSECOND);
+            if (sample != nullptr)
+                return new MappedSample(sample);
+            if (gst_app_sink_is_eos(sink) || bus_failed())
+                return nullptr;
+        }
+        BOOST_LOG_TRIVIAL(error) << "Capture pipeline stalled.";
+        return nullptr;
+    }
+public:
+    DualCapture() {}
+    DualCapture(const DualCapture&) = delete;
+    DualCapture& operator=(const DualCapture&) = delete;
+    ~DualCapture() {
+        close();
+    }
+
+    static std::string pipeline_description(const CameraConfig& config) {
+        std::string size = "width=(int)" + std::to_string(config.width) + ", height=(int)" + std::to_string(config.height);
+        std::string network = "width=(int)" + std::to_string(config.networkSize.width) + ", height=(int)" + std::to_string(config.networkSize.height);
+        std::string branch = "queue leaky=downstream max-size-buffers=1 ! ";
+        std::string sink = " max-buffers=1 drop=true sync=";
+        if (config.source == "csi") {
+            // NVMM until the tee; each branch gets its own VIC conversion into system memory
+            return "nvarguscamerasrc ! video/x-raw(memory:NVMM), " + size + ", format=(string)NV12, framerate=(fraction)" +
+                   std::to_string(config.fps) + "/1 ! nvvidconv flip-method=" + std::to_string(config.flipMethod) +
+                   " ! video/x-raw(memory:NVMM), format=(string)NV12 ! tee name=split "
+                   "split. ! " + branch + "nvvidconv ! video/x-raw, format=(string)NV12 ! appsink name=analysis" + sink + "false "
+                   "split. ! " + branch + "nvvidconv ! video/x-raw, " + network + ", format=(string)BGRx ! videoconvert ! "
+                   "video/x-raw, format=(string)BGR ! appsink name=network" + sink + "false";
+        }
+        std::string source;
+        bool live = config.source == "test";
+        if (live)
+            source = "videotestsrc is-live=true pattern=ball ! video/x-raw, " + size + ", format=(string)NV12, framerate=(fraction)" +
+                     std::to_string(config.fps) + "/1";
+        else // A file plays at its own rate (sync=true), as a camera would deliver it
+            source = "filesrc location=\"" + config.source + "\" ! decodebin ! videoconvert ! videoscale ! video/x-raw, " + size +
+                     ", format=(string)NV12";
+        std::string synced = live ? "false" : "true";
+        return source + " ! tee name=split "
+               "split. ! " + branch + "appsink name=analysis" + sink + synced + " "
+               "split. ! " + branch + "videoscale ! videoconvert ! video/x-raw, " + network + ", format=(string)BGR ! appsink name=network" + sink + synced;
+    }
+
+    bool open(const CameraConfig& config) {
+        if (!gst_is_initialized())
+            gst_init(nullptr, nullptr);
+        std::string description = pipeline_description(config);
+        GError* error = nullptr;
+        this->pipeline = gst_parse_launch(description.c_str(), &error);
+        if (error != nullptr) {
+            BOOST_LOG_TRIVIAL(error) << "Unable to build capture pipeline: " << error->message;
+            g_error_free(error);
+            close();
+            return false;
+        }
+        this->networkSink = GST_APP_SINK(gst_bin_get_by_name(GST_BIN(this->pipeline), "network"));
+        this->analysisSink = GST_APP_SINK(gst_bin_get_by_name(GST_BIN(this->pipeline), "analysis"));
+        if (this->networkSink == nullptr || this->analysisSink == nullptr
+            || gst_element_set_state(this->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+            BOOST_LOG_TRIVIAL(error) << "Unable to start capture pipeline: " << description;
+            close();
+            return false;
+        }
+        BOOST_LOG_TRIVIAL(info) << "Capturing " << config.width << "x" << config.height << " from " << config.source << " with a "
+                                << config.networkSize.width << "x" << config.networkSize.height << " network branch.";
+        return true;
+    }
+    void close() {
+        if (this->pipeline != nullptr)
+            gst_element_set_state(this->pipeline, GST_STATE_NULL);
+        if (this->networkSink != nullptr)
+            gst_object_unref(this->networkSink);
+        if (this->analysisSink != nullptr)
+            gst_object_unref(this->analysisSink);
+        if (this->pipeline != nullptr)
+            gst_object_unref(this->pipeline);
+        this->networkSink = this->analysisSink = nullptr;
+        this->pipeline = nullptr;
+    }
+    bool is_opened() const {
+        return this->pipeline != nullptr;
+    }
+
+    bool read(Frame& slot) {
+        // Blocks until both branches delivered the same frame; false once the source failed or ended
+        if (this->pipeline == nullptr)
+            return false;
+        std::shared_ptr<Samples> samples = std::make_shared<Samples>();
+        samples->network.reset(pull(this->networkSink));
+        samples->analysis.reset(pull(this->analysisSink));
+        for (int i = 0; samples->network && samples->analysis && samples->network->pts() != samples->analysis->pts(); i++) {
+            // A leaky queue dropped a buffer on one branch: advance the one that is behind
+            if (i == MAX_MATCH_PULLS) { // Use the closest pair rather than stall the pipeline
+                this->unmatched += 1;
+                break;
+            }
+            if (samples->network->pts() < samples->analysis->pts())
+                samples->network.reset(pull(this->networkSink));
+            else
+                samples->analysis.reset(pull(this->analysisSink));
+        }
+        if (!samples->network || !samples->analysis)
+            return false;
+        slot.image = samples->network->plane(0, CV_8UC3);
+        slot.gray = samples->analysis->plane(0, CV_8UC1); // Y plane of NV12
+        slot.grayGain = samples->analysis->limited_range() ? 255.0f / 219.0f : 1.0f;
+        slot.owner = samples;
+        return !slot.image.empty() && !slot.gray.empty();
+    }
+
+    uint64_t unmatched_count() const {
+        // Frames delivered with branches from different captures
+        return this->unmatched;
+    }
+};
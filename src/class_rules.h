@@ -0,0 +1,225 @@
+#pragma once
+#include <opencv2/core.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+
+#include "audio.h"
+#include "roi.h"
+#include "tracker.h"
+#include "warning_scheduler.h"
+
+// --- Detection to warning rules ---
+// One rule per network class. A box raises the rule's sample if its diagonal (frame pixels) lies strictly between
+// minSize and maxSize and every condition of the rule holds for the current frame.
+
+enum RuleCondition : uint8_t {
+    NEAR_OBSTACLE = 0x01, // Lidar mean distance <= 500 cm
+    MOVING        = 0x02,
+    STATIONARY    = 0x04,
+    APPROACHING   = 0x08, // Tracked box growing faster than APPROACH_RATE; only known when the tracker runs
+};
+enum class TrafficLight : uint8_t {None, Red, Green};
+
+struct ClassRule {
+    int sample;        // -1: class is ignored
+    int priority;
+    float minSize;
+    float maxSize;
+    uint8_t conditions;
+    TrafficLight light; // Red and green lights form a sequence, see ClassRules::apply_light()
+};
+
+const float APPROACH_RATE = 0.2f; // Relative box diagonal growth per second, i.e. under 5 s to contact
+const int NUM_CLASSES = 11; // MobileNet-SSD output classes, 0 is the background
+constexpr float NO_LIMIT = std::numeric_limits<float>::infinity();
+
+constexpr ClassRule DEFAULT_CLASS_RULES[NUM_CLASSES] = {
+    {-1,              0,   0.0f,   0.0f,     0,                      TrafficLight::None},  // Background
+    {WARN_PERSON,     300, 500.0f, NO_LIMIT, NEAR_OBSTACLE,          TrafficLight::None},
+    {WARN_BICYCLE,    400, 400.0f, NO_LIMIT, 0,                      TrafficLight::None},
+    {WARN_CAR,        500, 600.0f, NO_LIMIT, NEAR_OBSTACLE | MOVING, TrafficLight::None},
+    {WARN_MOTORCYCLE, 350, 550.0f, NO_LIMIT, MOVING,                 TrafficLight::None},
+    {WARN_BUS,        325, 700.0f, NO_LIMIT, NEAR_OBSTACLE | MOVING, TrafficLight::None},
+    {SUGG_BENCH,      90,  350.0f, 600.0f,   0,                      TrafficLight::None},
+    {SUGG_CHAIR,      80,  300.0f, 500.0f,   0,                      TrafficLight::None},
+    {SUGG_BIN,        100, 300.0f, 600.0f,   0,                      TrafficLight::None},
+    {WARN_LIGHTRED,   600, 100.0f, 300.0f,   STATIONARY,             TrafficLight::Red},
+    {WARN_LIGHTGREEN, 550, 100.0f, 300.0f,   STATIONARY,             TrafficLight::Green},
+};
+
+// Evaluates the rule table over the detection rows of a frame. The table is fixed after startup and the per-row
+// work is ordered from cheapest to most expensive test. Owned by the inference thread once the pipeline runs.
+class ClassRules {
+private:
+    ClassRule rules[NUM_CLASSES];
+    float minConfidence = 0.3f;
+
+    // A green light is only announced after a red one; the sequence resets LIGHT_RESET_FRAMES frames after the red
+    static const int LIGHT_RESET_FRAMES = 29;
+    int lightState = -1;  // -1 no red light seen, 0 red seen, 1 green announced
+    int lightFrames = 0;  // Frames since the last red light, 0 when not counting
+
+    bool apply_light(const ClassRule& rule) {
+        // Whether the rule's sample should be posted, updating the light sequence
+        if (rule.light == TrafficLight::Red) {
+            bool first = this->lightState == -1;
+            this->lightState = 0;
+            this->lightFrames = 1;
+            return first;
+        }
+        if (this->lightState != 0)
+            return false;
+        this->lightState = 1;
+        return true;
+    }
+    const ClassRule* candidate(int objectClass, float confidence, uint8_t conditions) const {
+        // The cheap tests, before any box arithmetic
+        if (confidence <= this->minConfidence || objectClass <= 0 || objectClass >= NUM_CLASSES)
+            return nullptr;
+        const ClassRule& rule = this->rules[objectClass];
+        if (rule.sample < 0 || (rule.conditions & ~conditions) != 0)
+            return nullptr;
+        return &rule;
+    }
+    void apply(const ClassRule& rule, const cv::Rect& box, float left, float right, WarningScheduler& warnings, double ttlMs) {
+        float d = static_cast<int>(std::sqrt(static_cast<double>(box.width * box.width + box.height * box.height)));
+        if (d <= rule.minSize || d >= rule.maxSize)
+            return;
+        float m = box.x + box.width / 2;
+        if (m < left || m > right)
+            return;
+        if (rule.light != TrafficLight::None && !apply_light(rule))
+            return;
+        warnings.post(rule.sample, rule.priority, ttlMs);
+    }
+    static bool parse_conditions(const std::string& text, uint8_t& conditions, TrafficLight& light) {
+        conditions = 0;
+        light = TrafficLight::None;
+        if (text == "-")
+            return true;
+        std::stringstream tokens(text);
+        std::string token;
+        while (std::getline(tokens, token, ',')) {
+            if (token == "near")
+                conditions |= NEAR_OBSTACLE;
+            else if (token == "moving")
+                conditions |= MOVING;
+            else if (token == "still")
+                conditions |= STATIONARY;
+            else if (token == "approaching")
+                conditions |= APPROACHING;
+            else if (token == "red")
+                light = TrafficLight::Red;
+            else if (token == "green")
+                light = TrafficLight::Green;
+            else
+                return false;
+        }
+        return true;
+    }
+public:
+    ClassRules() {
+        for (int i = 0; i < NUM_CLASSES; i++)
+            this->rules[i] = DEFAULT_CLASS_RULES[i];
+    }
+
+    bool load(const std::string& path) {
+        // Replaces the table with one read from a text file, one rule per line, '#' starts a comment:
+        //   <class> <sample> <priority> <min size> <max size | -> <conditions: near,moving,still,approaching,red,green | ->
+        // Classes missing from the file are ignored. On any error the current table is kept.
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            BOOST_LOG_TRIVIAL(error) << "Unable to open class rule file " << path;
+            return false;
+        }
+        ClassRule loaded[NUM_CLASSES];
+        for (int i = 0; i < NUM_CLASSES; i++)
+            loaded[i] = {-1, 0, 0.0f, 0.0f, 0, TrafficLight::None};
+
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line)) {
+            lineNumber += 1;
+            line = line.substr(0, line.find('#'));
+            std::istringstream fields(line);
+            int objectClass;
+            ClassRule rule;
+            std::string maxSize, conditions;
+            if (!(fields >> objectClass))
+                continue; // Blank or comment line
+            bool ok = static_cast<bool>(fields >> rule.sample >> rule.priority >> rule.minSize >> maxSize >> conditions);
+            rule.maxSize = NO_LIMIT;
+            if (ok && maxSize != "-")
+                ok = static_cast<bool>(std::istringstream(maxSize) >> rule.maxSize);
+            if (!ok || objectClass <= 0 || objectClass >= NUM_CLASSES || rule.sample < 0 || rule.sample >= NUM_WAVEFORMS
+                || !parse_conditions(conditions, rule.conditions, rule.light)) {
+                BOOST_LOG_TRIVIAL(error) << "Invalid class rule in " << path << ":" << lineNumber << "; keeping the current rules.";
+                return false;
+            }
+            loaded[objectClass] = rule;
+        }
+        for (int i = 0; i < NUM_CLASSES; i++)
+            this->rules[i] = loaded[i];
+        BOOST_LOG_TRIVIAL(info) << "Loaded class rules from " << path << ".";
+        return true;
+    }
+
+    static uint8_t conditions(bool nearObstacle, bool moving) {
+        // Conditions that hold for the current frame
+        return (nearObstacle ? NEAR_OBSTACLE : 0) | (moving ? MOVING : STATIONARY);
+    }
+
+    void evaluate(const cv::Mat& detections, const cv::Rect& region, const cv::Size& frameSize, uint8_t frameConditions,
+                  WarningScheduler& warnings, double ttlMs) {
+        // Detection rows of a network pass; duplicates are filtered by the warning scheduler
+        float left = DECISION_LEFT * frameSize.width, right = DECISION_RIGHT * frameSize.width;
+        for (int i = 0; i < detections.rows; i++) {
+            const float* row = detections.ptr<float>(i); // image, class, confidence, x1, y1, x2, y2
+            const ClassRule* rule = candidate(static_cast<int>(row[1]), row[2], frameConditions);
+            if (rule != nullptr)
+                apply(*rule, InferenceRoi::map_box(row, region), left, right, warnings, ttlMs);
+        }
+    }
+    void evaluate(const std::vector<Track>& tracks, const cv::Size& frameSize, uint8_t frameConditions,
+                  WarningScheduler& warnings, double ttlMs) {
+        // Tracked boxes, fresh or predicted. Only tracks the last network pass matched count: the others are kept for
+        // re-association but may have left the scene. A track counts with its confidence decayed since that pass and
+        // also satisfies APPROACHING while its box grows fast enough.
+        float left = DECISION_LEFT * frameSize.width, right = DECISION_RIGHT * frameSize.width;
+        for (const Track& t : tracks) {
+            if (t.misses > 0)
+                continue;
+            uint8_t conditions = frameConditions | (t.approach_rate() > APPROACH_RATE ? APPROACHING : 0);
+            const ClassRule* rule = candidate(t.objectClass, t.confidence, conditions);
+            if (rule != nullptr)
+                apply(*rule, t.box(), left, right, warnings, ttlMs);
+        }
+    }
+    void collect(const cv::Mat& detections, const cv::Rect& region, std::vector<TrackedDetection>& found) const {
+        // Detection rows worth tracking: confident enough and of a class some rule reacts to
+        found.clear();
+        for (int i = 0; i < detections.rows; i++) {
+            const float* row = detections.ptr<float>(i);
+            int objectClass = static_cast<int>(row[1]);
+            if (row[2] <= this->minConfidence || objectClass <= 0 || objectClass >= NUM_CLASSES || this->rules[objectClass].sample < 0)
+                continue;
+            found.push_back({objectClass, row[2], InferenceRoi::map_box(row, region)});
+        }
+    }
+    void end_frame() {
+        if (this->lightFrames != 0)
+            this->lightFrames += 1;
+        if (this->lightFrames == LIGHT_RESET_FRAMES + 1) {
+            this->lightFrames = 0;
+            this->lightState = -1;
+        }
+    }
+};
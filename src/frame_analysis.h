@@ -0,0 +1,254 @@
+#pragma once
+#include <opencv2/core.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "pyramid.h"
+
+// Cheap per-frame analytics run before the network: day/night classification and the blur score.
+
+enum class Imclass {Day, Night, None};
+
+// --- Day/night classification ---
+// Mean HSV value (max(B, G, R)) of the top band of the frame, where the sky or ceiling is, read straight from the BGR
+// frame: LUMA_ROWS rows spread over the band, each sampled as LUMA_RUNS runs of 16 contiguous pixels, i.e. 4096
+// pixel reads instead of a pass over the whole frame.
+static const int LUMA_BAND_NUM = 16, LUMA_BAND_DEN = 35; // Top 16/35 of the frame, the rows the classifier always used
+static const int LUMA_ROWS = 16;
+static const int LUMA_RUNS = 16;
+
+inline int max_channel_run(const uchar* bgr) {
+    // Sum of max(B, G, R) over 16 pixels; reads two bytes past the run
+#if defined(__ARM_NEON)
+    uint8x16x3_t pixels = vld3q_u8(bgr);
+    uint8x16_t v = vmaxq_u8(vmaxq_u8(pixels.val[0], pixels.val[1]), pixels.val[2]);
+    uint32_t sums[4];
+    vst1q_u32(sums, vpaddlq_u16(vpaddlq_u8(v)));
+    return static_cast<int>(sums[0] + sums[1] + sums[2] + sums[3]);
+#elif defined(__SSE2__)
+    // Byte i of max(p, p + 1, p + 2) is max(B, G, R) where i starts a pixel; the masks keep those bytes of each of the
+    // three 16-byte blocks, and sad_epu8 adds them up
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i masks[3] = {_mm_setr_epi8(-1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1),
+                              _mm_setr_epi8(0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0),
+                              _mm_setr_epi8(0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0)};
+    __m128i acc = zero;
+    for (int block = 0; block < 3; block++) {
+        const uchar* q = bgr + 16 * block;
+        __m128i v = _mm_max_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(q)),
+                                 _mm_max_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(q + 1)),
+                                              _mm_loadu_si128(reinterpret_cast<const __m128i*>(q + 2))));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_and_si128(v, masks[block]), zero));
+    }
+    return _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+#else
+    int sum = 0;
+    for (int i = 0; i < 16; i++)
+        sum += std::max(bgr[3 * i], std::max(bgr[3 * i + 1], bgr[3 * i + 2]));
+    return sum;
+#endif
+}
+
+inline float top_band_luminance(const cv::Mat& bgr) {
+    // -1 for anything but a BGR frame wide enough for one run (plus the bytes max_channel_run reads past it)
+    if (bgr.type() != CV_8UC3 || bgr.cols < 17 || bgr.rows < 1)
+        return -1.0f;
+    int band = std::max(1, bgr.rows * LUMA_BAND_NUM / LUMA_BAND_DEN);
+    int64_t sum = 0;
+    for (int r = 0; r < LUMA_ROWS; r++) {
+        const uchar* row = bgr.ptr<uchar>((2 * r + 1) * band / (2 * LUMA_ROWS));
+        for (int run = 0; run < LUMA_RUNS; run++) {
+            int x = std::min((2 * run + 1) * bgr.cols / (2 * LUMA_RUNS) - 8, bgr.cols - 17);
+            sum += max_channel_run(row + 3 * std::max(x, 0));
+        }
+    }
+    return static_cast<float>(sum) / (LUMA_ROWS * LUMA_RUNS * 16);
+}
+
+struct DayNightConfig {
+    float nightBelow = 80.0f;  // Luminance the estimate must fall below to turn night ...
+    float dayAbove = 100.0f;   // ... and rise above to turn day again (the old single threshold was 90)
+    double smoothingMs = 300.0; // Time constant of the running estimate
+    double debounceMs = 700.0;  // The estimate must stay past a threshold this long before the state flips
+};
+
+// Running luminance estimate with hysteresis and a time-based debounce. The first frame decides the initial state
+// against the middle of the two thresholds.
+class DayNightClassifier {
+private:
+    DayNightConfig config;
+    float estimate = -1.0f;
+    double lastMs = 0.0;
+    double crossedMs = -1.0; // Since when the estimate has been past the threshold of the other state, -1 if it is not
+    Imclass state = Imclass::None;
+public:
+    DayNightClassifier(const DayNightConfig& config = DayNightConfig()) : config(config) {}
+
+    Imclass update(const cv::Mat& bgr, double nowMs) {
+        float luminance = top_band_luminance(bgr);
+        if (luminance < 0.0f)
+            return this->state;
+        if (this->state == Imclass::None) {
+            this->estimate = luminance;
+            this->state = luminance < (this->config.nightBelow + this->config.dayAbove) / 2 ? Imclass::Night : Imclass::Day;
+            this->lastMs = nowMs;
+            return this->state;
+        }
+        double alpha = 1.0 - std::exp(-std::max(nowMs - this->lastMs, 0.0) / this->config.smoothingMs);
+        this->estimate += static_cast<float>(alpha) * (luminance - this->estimate);
+        this->lastMs = nowMs;
+
+        bool crossed = this->state == Imclass::Day ? this->estimate < this->config.nightBelow : this->estimate > this->config.dayAbove;
+        if (!crossed) {
+            this->crossedMs = -1.0;
+        } else if (this->crossedMs < 0.0) {
+            this->crossedMs = nowMs;
+        } else if (nowMs - this->crossedMs >= this->config.debounceMs) {
+            this->state = this->state == Imclass::Day ? Imclass::Night : Imclass::Day;
+            this->crossedMs = -1.0;
+        }
+        return this->state;
+    }
+
+    Imclass current() const {
+        return this->state;
+    }
+    float luminance() const {
+        return this->estimate;
+    }
+};
+
+// --- Blur score ---
+// Variance of the 4-neighbour Laplacian of the gray image: the statistic cv::Laplacian and cv::meanStdDev used to
+// give, computed in one fused pass with 16-bit integer arithmetic and sum and sum of squares accumulated together.
+// Only every BLUR_ROW_STEP-th row is scored, but each sampled pixel still uses its full-resolution neighbours, so the
+// result estimates the same variance without any scale factor (the one-pixel frame border is left out).
+static const int BLUR_ROW_STEP = 2;
+
+inline void laplacian_row(const uchar* up, const uchar* mid, const uchar* down, int cols, int64_t& sum, uint64_t& sumSq) {
+    // Columns 1 .. cols - 2; the Laplacian of 8-bit input lies within +-1020, its square within 20 bits
+    int x = 1;
+#if defined(__AVX2__)
+    {
+        const __m256i zero = _mm256_setzero_si256(), ones = _mm256_set1_epi16(1);
+        __m256i accSum = zero, accSq = zero;
+        for (; x + 32 <= cols - 1; x += 32) {
+            __m256i u = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(up + x));
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(down + x));
+            __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mid + x - 1));
+            __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mid + x + 1));
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mid + x));
+            // Unpacking works within 128-bit lanes, which reorders pixels; the sums do not care
+            __m256i lo = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(u, zero), _mm256_unpacklo_epi8(d, zero)),
+                                                           _mm256_add_epi16(_mm256_unpacklo_epi8(l, zero), _mm256_unpacklo_epi8(r, zero))),
+                                          _mm256_slli_epi16(_mm256_unpacklo_epi8(c, zero), 2));
+            __m256i hi = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(u, zero), _mm256_unpackhi_epi8(d, zero)),
+                                                           _mm256_add_epi16(_mm256_unpackhi_epi8(l, zero), _mm256_unpackhi_epi8(r, zero))),
+                                          _mm256_slli_epi16(_mm256_unpackhi_epi8(c, zero), 2));
+            accSum = _mm256_add_epi32(accSum, _mm256_add_epi32(_mm256_madd_epi16(lo, ones), _mm256_madd_epi16(hi, ones)));
+            accSq = _mm256_add_epi32(accSq, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+        }
+        int32_t sums[8];
+        uint32_t squares[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums), accSum);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(squares), accSq);
+        for (int i = 0; i < 8; i++) {
+            sum += sums[i];
+            sumSq += squares[i];
+        }
+    }
+#elif defined(__SSE2__)
+    {
+        const __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi16(1);
+        __m128i accSum = zero, accSq = zero;
+        for (; x + 16 <= cols - 1; x += 16) {
+            __m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + x));
+            __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mid + x - 1));
+            __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mid + x + 1));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mid + x));
+            __m128i lo = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(u, zero), _mm_unpacklo_epi8(d, zero)),
+                                                     _mm_add_epi16(_mm_unpacklo_epi8(l, zero), _mm_unpacklo_epi8(r, zero))),
+                                       _mm_slli_epi16(_mm_unpacklo_epi8(c, zero), 2));
+            __m128i hi = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(u, zero), _mm_unpackhi_epi8(d, zero)),
+                                                     _mm_add_epi16(_mm_unpackhi_epi8(l, zero), _mm_unpackhi_epi8(r, zero))),
+                                       _mm_slli_epi16(_mm_unpackhi_epi8(c, zero), 2));
+            accSum = _mm_add_epi32(accSum, _mm_add_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones)));
+            accSq = _mm_add_epi32(accSq, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+        int32_t sums[4];
+        uint32_t squares[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), accSum);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(squares), accSq);
+        for (int i = 0; i < 4; i++) {
+            sum += sums[i];
+            sumSq += squares[i];
+        }
+    }
+#elif defined(__ARM_NEON)
+    {
+        int32x4_t accSum = vdupq_n_s32(0), accSq = vdupq_n_s32(0);
+        for (; x + 16 <= cols - 1; x += 16) {
+            uint8x16_t u = vld1q_u8(up + x), d = vld1q_u8(down + x);
+            uint8x16_t l = vld1q_u8(mid + x - 1), r = vld1q_u8(mid + x + 1), c = vld1q_u8(mid + x);
+            // Computed in unsigned 16-bit lanes; the result is in range, so reading it back as signed is exact
+            int16x8_t lo = vreinterpretq_s16_u16(vsubq_u16(vaddq_u16(vaddl_u8(vget_low_u8(u), vget_low_u8(d)), vaddl_u8(vget_low_u8(l), vget_low_u8(r))),
+                                                           vshll_n_u8(vget_low_u8(c), 2)));
+            int16x8_t hi = vreinterpretq_s16_u16(vsubq_u16(vaddq_u16(vaddl_u8(vget_high_u8(u), vget_high_u8(d)), vaddl_u8(vget_high_u8(l), vget_high_u8(r))),
+                                                           vshll_n_u8(vget_high_u8(c), 2)));
+            accSum = vpadalq_s16(vpadalq_s16(accSum, lo), hi);
+            accSq = vmlal_s16(vmlal_s16(accSq, vget_low_s16(lo), vget_low_s16(lo)), vget_high_s16(lo), vget_high_s16(lo));
+            accSq = vmlal_s16(vmlal_s16(accSq, vget_low_s16(hi), vget_low_s16(hi)), vget_high_s16(hi), vget_high_s16(hi));
+        }
+        int32_t sums[4];
+        uint32_t squares[4];
+        vst1q_s32(sums, accSum);
+        vst1q_u32(squares, vreinterpretq_u32_s32(accSq));
+        for (int i = 0; i < 4; i++) {
+            sum += sums[i];
+            sumSq += squares[i];
+        }
+    }
+#endif
+    for (; x < cols - 1; x++) {
+        int v = up[x] + down[x] + mid[x - 1] + mid[x + 1] - 4 * mid[x];
+        sum += v;
+        sumSq += static_cast<uint64_t>(v * v);
+    }
+}
+
+float laplacian(const FramePyramid& pyramid, float stopAbove = 0.0f) {
+    // stopAbove > 0: return as soon as the score is certain to exceed it. By the law of total variance the score is
+    // at least (scored / total) * (variance so far), so a sharp frame usually stops after a fraction of its rows; the
+    // value returned is then the variance of the rows scored so far.
+    const cv::Mat& gray = pyramid.gray();
+    if (gray.rows < 3 || gray.cols < 3)
+        return 0.0f;
+    int sampledRows = (gray.rows - 3) / BLUR_ROW_STEP + 1;
+    double total = static_cast<double>(sampledRows) * (gray.cols - 2);
+    int64_t sum = 0;
+    uint64_t sumSq = 0;
+    int scoredRows = 0;
+    for (int y = 1; y < gray.rows - 1; y += BLUR_ROW_STEP) {
+        laplacian_row(gray.ptr<uchar>(y - 1), gray.ptr<uchar>(y), gray.ptr<uchar>(y + 1), gray.cols, sum, sumSq);
+        scoredRows += 1;
+        if (stopAbove > 0.0f && scoredRows % 8 == 0) {
+            double n = static_cast<double>(scoredRows) * (gray.cols - 2);
+            double mean = sum / n, variance = sumSq / n - mean * mean;
+            if (n / total * variance > stopAbove)
+                return static_cast<float>(variance);
+        }
+    }
+    double n = static_cast<double>(scoredRows) * (gray.cols - 2);
+    double mean = sum / n;
+    return static_cast<float>(sumSq / n - mean * mean);
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <opencv2/core.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+// Single-producer/single-consumer triple buffer for camera frames. The producer always owns one slot (back),
+// the consumer always owns one slot (front) and the third slot (middle) is handed over with one atomic exchange,
+// so neither side ever sees a half-written frame and no image data is copied on handoff.
+struct Frame {
+    cv::Mat image;               // BGR: the whole frame, or with a dual-branch capture the frame at network resolution
+    cv::Mat gray;                // Dual-branch capture only: the full-resolution luma plane
+    float grayGain = 1.0f;       // Scale from gray to full-range luma (255 / 219 for limited-range video)
+    std::shared_ptr<void> owner; // Keeps capture buffers that image and gray point into alive while the slot holds them
+    uint64_t sequence = 0;
+    std::chrono::steady_clock::time_point timestamp;
+
+    cv::Size size() const {
+        // Full capture resolution, the coordinate system of the perception stages
+        return this->gray.empty() ? this->image.size() : this->gray.size();
+    }
+};
+
+class FrameBuffer {
+private:
+    static const uint8_t INDEX_MASK = 0x03;
+    static const uint8_t FRESH_BIT  = 0x04; // Set while the middle slot holds a frame the consumer has not taken yet
+
+    Frame slots[3];
+    std::atomic<uint8_t> middle;
+    uint8_t back;  // Producer-owned
+    uint8_t front; // Consumer-owned
+
+    uint64_t nextSequence = 0;
+    uint64_t lastSequence = 0;
+    std::atomic<uint64_t> published;
+    std::atomic<uint64_t> dropped;
+
+    std::mutex waitMutex; // Only used to park the consumer, never held while touching frame data
+    std::condition_variable waitCondition;
+public:
+    FrameBuffer() : middle(1), back(0), front(2), published(0), dropped(0) {}
+
+    // --- Producer side ---
+    cv::Mat& back_buffer() {
+        // Writing into the same Mat every time lets cv::VideoCapture reuse the slot's allocation
+        return this->slots[this->back].image;
+    }
+    Frame& back_slot() {
+        return this->slots[this->back];
+    }
+    void publish() {
+        Frame& slot = this->slots[this->back];
+        slot.sequence = ++this->nextSequence;
+        slot.timestamp = std::chrono::steady_clock::now();
+
+        uint8_t prev = this->middle.exchange(this->back | FRESH_BIT, std::memory_order_acq_rel);
+        if (prev & FRESH_BIT) // Consumer never saw the frame we just replaced
+            this->dropped.fetch_add(1, std::memory_order_relaxed);
+        this->back = prev & INDEX_MASK;
+        this->published.fetch_add(1, std::memory_order_relaxed);
+
+        { std::lock_guard<std::mutex> lock(this->waitMutex); }
+        this->waitCondition.notify_one();
+    }
+
+    // --- Consumer side ---
+    bool acquire() {
+        // Take the newest complete frame if there is one; returns false when nothing new arrived since the last call
+        if (!(this->middle.load(std::memory_order_acquire) & FRESH_BIT))
+            return false;
+        uint8_t prev = this->middle.exchange(this->front, std::memory_order_acq_rel);
+        this->front = prev & INDEX_MASK;
+        this->lastSequence = this->slots[this->front].sequence;
+        return true;
+    }
+    bool wait_and_acquire(std::chrono::milliseconds timeout) {
+        if (acquire())
+            return true;
+        std::unique_lock<std::mutex> lock(this->waitMutex);
+        this->waitCondition.wait_for(lock, timeout, [this] {
+            return (this->middle.load(std::memory_order_acquire) & FRESH_BIT) != 0;
+        });
+        lock.unlock();
+        return acquire();
+    }
+    const Frame& current() const {
+        return this->slots[this->front];
+    }
+    double frame_age_ms() const {
+        // Time since the frame currently held by the consumer was captured
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->slots[this->front].timestamp).count();
+    }
+
+    // --- Statistics ---
+    uint64_t last_sequence() const {
+        return this->lastSequence;
+    }
+    uint64_t published_count() const {
+        return this->published.load(std::memory_order_relaxed);
+    }
+    uint64_t dropped_count() const {
+        return this->dropped.load(std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,367 @@
+#pragma once
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+
+#include "metrics.h"
+
+// --- Shared I2C bus arbitration ---
+// One I2CBus owns each /dev/i2c-N and every driver on that bus submits its transfers to it as i2c_msg lists. There
+// is no bus thread: the caller that finds the bus idle executes the queue on behalf of everyone waiting, highest
+// priority first. Register reads queued for the same device are merged into a single I2C_RDWR ioctl where they fit;
+// anything that writes goes out on its own, as the messages before a failure in an ioctl have already been executed.
+// A realtime transaction therefore waits for at most the one batch already on the wire. Per-device statistics are
+// published with the pipeline metrics.
+
+enum class BusPriority : int {Bulk = 0, Normal = 1, Realtime = 2};
+
+struct BusDeviceStats {
+    static const int LATENCY_BUCKETS = 16; // Bucket i: submit-to-completion under 2^(i+4) us; the last one is open ended
+
+    std::string name;
+    uint16_t address = 0;
+    uint64_t transactions = 0;
+    uint64_t errors = 0;
+    uint64_t latency[LATENCY_BUCKETS] = {};
+    double totalLatencyUs = 0.0;
+    double maxLatencyUs = 0.0;
+
+    static double bucket_limit_us(int bucket) {
+        return static_cast<double>(1u << (bucket + 4));
+    }
+    double mean_us() const {
+        return this->transactions ? this->totalLatencyUs / this->transactions : 0.0;
+    }
+    double percentile_us(double p) const {
+        // Upper bound of the bucket holding the p-quantile
+        uint64_t rank = static_cast<uint64_t>(p * this->transactions), seen = 0;
+        for (int i = 0; i < LATENCY_BUCKETS; i++) {
+            seen += this->latency[i];
+            if (seen > rank)
+                return i == LATENCY_BUCKETS - 1 ? this->maxLatencyUs : bucket_limit_us(i);
+        }
+        return this->maxLatencyUs;
+    }
+};
+
+class I2CBus {
+private:
+    struct Transaction {
+        int device;
+        BusPriority priority;
+        uint64_t order;
+        struct i2c_msg* messages;
+        int count;
+        std::chrono::steady_clock::time_point submitted;
+        bool done = false;
+        bool ok = false;
+
+        bool register_read() const {
+            // Register pointer write followed by a read (read_registers()); nothing else may share an ioctl
+            return this->count == 2 && !(this->messages[0].flags & I2C_M_RD) && this->messages[0].len == 1
+                   && (this->messages[1].flags & I2C_M_RD);
+        }
+    };
+    struct Before {
+        // priority_queue pops its largest element: higher priority first, FIFO within a priority
+        bool operator()(const Transaction* a, const Transaction* b) const {
+            if (a->priority != b->priority)
+                return a->priority < b->priority;
+            return a->order > b->order;
+        }
+    };
+
+    int bus;
+    int fd = -1;
+    bool combined = false;  // Adapter supports I2C_RDWR (repeated start); otherwise messages go out one by one
+    int boundAddress = -1;  // I2C_SLAVE binding of the message-by-message fallback
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::priority_queue<Transaction*, std::vector<Transaction*>, Before> queue;
+    bool executing = false;
+    uint64_t submitted = 0;
+    uint64_t ioctls = 0;
+    std::size_t maxQueueDepth = 0;
+    std::vector<BusDeviceStats> devices;
+    std::vector<BusPriority> devicePriority;
+
+    // Scratch space of the executing caller; only one caller executes at a time
+    std::vector<Transaction*> batch;
+    std::vector<struct i2c_msg> batchMessages;
+
+    I2CBus(int bus) : bus(bus) {
+        char filename[32];
+        snprintf(filename, sizeof(filename), "/dev/i2c-%d", bus);
+        this->fd = ::open(filename, O_RDWR);
+        if (this->fd < 0) {
+            BOOST_LOG_TRIVIAL(error) << "Unable to open " << filename;
+            return;
+        }
+        unsigned long funcs = 0;
+        this->combined = ioctl(this->fd, I2C_FUNCS, &funcs) == 0 && (funcs & I2C_FUNC_I2C);
+        if (!this->combined)
+            BOOST_LOG_TRIVIAL(warning) << filename << " does not support combined transfers; sending I2C messages one by one.";
+        this->batch.reserve(I2C_RDWR_IOCTL_MAX_MSGS);
+        this->batchMessages.reserve(I2C_RDWR_IOCTL_MAX_MSGS);
+    }
+
+    struct Registry {
+        std::mutex mutex;
+        std::map<int, std::unique_ptr<I2CBus>> buses;
+        bool exported = false; // prometheus_text() is registered with Metrics
+    };
+    static Registry& registry() {
+        static Registry instance;
+        return instance;
+    }
+
+    bool execute(struct i2c_msg* messages, int count) {
+        // Runs without the lock held; called by the executing caller only
+        if (this->combined) {
+            struct i2c_rdwr_ioctl_data data;
+            data.msgs = messages;
+            data.nmsgs = count;
+            return ioctl(this->fd, I2C_RDWR, &data) == count;
+        }
+        for (int i = 0; i < count; i++) {
+            if (this->boundAddress != messages[i].addr) {
+                if (ioctl(this->fd, I2C_SLAVE, messages[i].addr) < 0) {
+                    this->boundAddress = -1;
+                    return false;
+                }
+                this->boundAddress = messages[i].addr;
+            }
+            ssize_t done = (messages[i].flags & I2C_M_RD) ? read(this->fd, messages[i].buf, messages[i].len)
+                                                         : write(this->fd, messages[i].buf, messages[i].len);
+            if (done != messages[i].len)
+                return false;
+        }
+        return true;
+    }
+    void run_batch(std::unique_lock<std::mutex>& lock) {
+        // Take queued transactions in priority order while they are register reads of the first one's device and fit
+        // into one ioctl
+        this->batch.clear();
+        this->batchMessages.clear();
+        while (!this->queue.empty()) {
+            Transaction* next = this->queue.top();
+            if (!this->batch.empty() && (!this->batch[0]->register_read() || !next->register_read() || next->device != this->batch[0]->device
+                                         || this->batchMessages.size() + next->count > I2C_RDWR_IOCTL_MAX_MSGS))
+                break;
+            this->queue.pop();
+            this->batch.push_back(next);
+            this->batchMessages.insert(this->batchMessages.end(), next->messages, next->messages + next->count);
+        }
+        this->executing = true;
+        lock.unlock();
+
+        // Never retried: reads can pop data (FIFO and record registers), so a failure is reported to every caller in the
+        // batch, all of which addressed the one device that failed
+        bool ok = execute(this->batchMessages.data(), static_cast<int>(this->batchMessages.size()));
+        for (Transaction* t : this->batch)
+            t->ok = ok;
+
+        lock.lock();
+        this->ioctls += 1;
+        auto now = std::chrono::steady_clock::now();
+        for (Transaction* t : this->batch) {
+            BusDeviceStats& stats = this->devices[t->device];
+            double us = std::chrono::duration<double, std::micro>(now - t->submitted).count();
+            int bucket = 0;
+            while (bucket < BusDeviceStats::LATENCY_BUCKETS - 1 && us >= BusDeviceStats::bucket_limit_us(bucket))
+                bucket++;
+            stats.latency[bucket] += 1;
+            stats.transactions += 1;
+            stats.totalLatencyUs += us;
+            if (us > stats.maxLatencyUs)
+                stats.maxLatencyUs = us;
+            if (!t->ok)
+                stats.errors += 1;
+            t->done = true;
+        }
+        this->executing = false;
+        this->finished.notify_all();
+    }
+public:
+    ~I2CBus() {
+        if (this->fd >= 0)
+            close(this->fd);
+    }
+
+    static I2CBus* open(int bus) {
+        // The process-wide arbiter of /dev/i2c-<bus>, opened on first use; nullptr if the device cannot be opened
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        auto found = r.buses.find(bus);
+        if (found != r.buses.end())
+            return found->second.get();
+        std::unique_ptr<I2CBus> created(new I2CBus(bus));
+        if (created->fd < 0)
+            return nullptr;
+        I2CBus* result = created.get();
+        r.buses[bus] = std::move(created);
+        if (!r.exported) {
+            Metrics::global().add_collector(&I2CBus::prometheus_text);
+            r.exported = true;
+        }
+        return result;
+    }
+    static void prometheus_text(std::ostream& out) {
+        // Per-device latency histograms and error counts and the queue depth of every bus, in the format of Metrics
+        struct BusSnapshot {
+            int bus;
+            std::vector<BusDeviceStats> devices;
+            std::size_t depth, maxDepth;
+            uint64_t ioctls;
+        };
+        std::vector<BusSnapshot> buses;
+        {
+            Registry& r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            for (auto& entry : r.buses) {
+                I2CBus& b = *entry.second;
+                std::lock_guard<std::mutex> busLock(b.mutex);
+                buses.push_back({b.bus, b.devices, b.queue.size(), b.maxQueueDepth, b.ioctls});
+            }
+        }
+        out << "# HELP guide_i2c_latency_seconds Submit-to-completion time of an I2C transaction.\n"
+            << "# TYPE guide_i2c_latency_seconds histogram\n";
+        for (const BusSnapshot& b : buses) {
+            for (const BusDeviceStats& d : b.devices) {
+                std::string labels = "bus=\"" + std::to_string(b.bus) + "\",device=\"" + d.name + "\"";
+                uint64_t cumulative = 0;
+                for (int i = 0; i < BusDeviceStats::LATENCY_BUCKETS - 1; i++) {
+                    cumulative += d.latency[i];
+                    out << "guide_i2c_latency_seconds_bucket{" << labels << ",le=\"" << BusDeviceStats::bucket_limit_us(i) * 1e-6 << "\"} " << cumulative << "\n";
+                }
+                out << "guide_i2c_latency_seconds_bucket{" << labels << ",le=\"+Inf\"} " << d.transactions << "\n"
+                    << "guide_i2c_latency_seconds_sum{" << labels << "} " << d.totalLatencyUs * 1e-6 << "\n"
+                    << "guide_i2c_latency_seconds_count{" << labels << "} " << d.transactions << "\n";
+            }
+        }
+        out << "# TYPE guide_i2c_errors_total counter\n";
+        for (const BusSnapshot& b : buses) {
+            for (const BusDeviceStats& d : b.devices)
+                out << "guide_i2c_errors_total{bus=\"" << b.bus << "\",device=\"" << d.name << "\"} " << d.errors << "\n";
+        }
+        out << "# TYPE guide_i2c_queue_depth gauge\n";
+        for (const BusSnapshot& b : buses)
+            out << "guide_i2c_queue_depth{bus=\"" << b.bus << "\"} " << b.depth << "\n";
+        out << "# TYPE guide_i2c_max_queue_depth gauge\n";
+        for (const BusSnapshot& b : buses)
+            out << "guide_i2c_max_queue_depth{bus=\"" << b.bus << "\"} " << b.maxDepth << "\n";
+        out << "# TYPE guide_i2c_transfers_total counter\n";
+        for (const BusSnapshot& b : buses)
+            out << "guide_i2c_transfers_total{bus=\"" << b.bus << "\"} " << b.ioctls << "\n";
+    }
+    static void log_all_stats() {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (auto& entry : r.buses)
+            entry.second->log_stats();
+    }
+
+    int register_device(const std::string& name, uint16_t address, BusPriority priority) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        BusDeviceStats stats;
+        stats.name = name;
+        stats.address = address;
+        this->devices.push_back(stats);
+        this->devicePriority.push_back(priority);
+        return static_cast<int>(this->devices.size()) - 1;
+    }
+
+    // --- Transfers ---
+    bool transfer(int device, struct i2c_msg* messages, int count) {
+        return transfer(device, messages, count, this->devicePriority[device]);
+    }
+    bool transfer(int device, struct i2c_msg* messages, int count, BusPriority priority) {
+        // Blocks until the messages went out; at most I2C_RDWR_IOCTL_MAX_MSGS messages per transaction
+        if (count <= 0 || count > I2C_RDWR_IOCTL_MAX_MSGS)
+            return false;
+        Transaction t;
+        t.device = device;
+        t.priority = priority;
+        t.messages = messages;
+        t.count = count;
+        t.submitted = std::chrono::steady_clock::now();
+
+        std::unique_lock<std::mutex> lock(this->mutex);
+        t.order = this->submitted++;
+        this->queue.push(&t);
+        if (this->queue.size() > this->maxQueueDepth)
+            this->maxQueueDepth = this->queue.size();
+        while (!t.done) {
+            if (!this->executing)
+                run_batch(lock);
+            else
+                this->finished.wait(lock);
+        }
+        return t.ok;
+    }
+    bool read_registers(int device, uint16_t address, uint8_t reg, uint8_t* dest, uint16_t count) {
+        // Register pointer write and read with a repeated start; dest is zeroed if the transfer fails
+        struct i2c_msg messages[2];
+        messages[0].addr = address;
+        messages[0].flags = 0;
+        messages[0].len = 1;
+        messages[0].buf = &reg;
+        messages[1].addr = address;
+        messages[1].flags = I2C_M_RD;
+        messages[1].len = count;
+        messages[1].buf = dest;
+        if (transfer(device, messages, 2))
+            return true;
+        memset(dest, 0, count);
+        return false;
+    }
+    bool write_register(int device, uint16_t address, uint8_t reg, uint8_t value) {
+        uint8_t buffer[2] = {reg, value};
+        struct i2c_msg message;
+        message.addr = address;
+        message.flags = 0;
+        message.len = 2;
+        message.buf = buffer;
+        return transfer(device, &message, 1);
+    }
+
+    // --- Statistics ---
+    std::vector<BusDeviceStats> stats() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->devices;
+    }
+    std::size_t queue_depth() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->queue.size();
+    }
+    std::size_t max_queue_depth() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->maxQueueDepth;
+    }
+    void log_stats() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        BOOST_LOG_TRIVIAL(info) << "I2C bus " << this->bus << ": " << this->submitted << " transactions in " << this->ioctls
+                                << " transfers, max queue depth " << this->maxQueueDepth << ".";
+        for (const BusDeviceStats& d : this->devices) {
+            BOOST_LOG_TRIVIAL(info) << "  " << d.name << " (0x" << std::hex << d.address << std::dec << "): " << d.transactions << " transactions, "
+                                    << d.errors << " errors, latency mean " << d.mean_us() << " us, p50 < " << d.percentile_us(0.5)
+                                    << " us, p99 < " << d.percentile_us(0.99) << " us, max " << d.maxLatencyUs << " us.";
+        }
+    }
+};
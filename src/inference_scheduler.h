@@ -0,0 +1,96 @@
+#pragma once
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+
+#include "ring_window.h"
+
+// Decides per frame whether the network runs. Inputs are all cheap by-products of preprocessing and the motion
+// sensor: the mean absolute difference of a small gray level against the last frame the network saw, the blur
+// score, and the gyro rate. Static scenes are sampled at a low rate, frames smeared by a fast head movement are
+// dropped, and an abrupt scene change is flagged so a tracker can ask for a fresh pass right away.
+
+struct SchedulerConfig {
+    bool enabled = false;
+    float staticDifference = 2.0f;  // Mean absolute gray difference below which the scene counts as unchanged
+    float changeDifference = 12.0f; // ... and above which it changed abruptly
+    float quietGyro = 10.0f;        // deg/s; below this the head counts as still
+    float swingGyro = 120.0f;       // deg/s; above this a frame is likely motion blurred
+    float blurRatio = 0.5f;         // A swing frame is dropped if its blur score is below this fraction of the recent median
+    double staticIntervalMs = 1000.0; // Network rate on a static scene
+};
+
+enum class InferenceDecision {Run, SceneChange, SkipStatic, SkipBlur};
+
+class InferenceScheduler {
+private:
+    SchedulerConfig config;
+    cv::Mat reference;               // Small gray level of the last frame the network ran on
+    RingWindow<float, 16, true> sharpness; // Blur scores of recent frames that were not dropped as blurred
+    double lastRunMs = -1.0;
+    uint64_t decisions[4] = {};
+
+    float difference(const cv::Mat& small) const {
+        // Mean absolute difference to the reference, or -1 if there is nothing comparable
+        if (this->reference.empty() || this->reference.rows != small.rows || this->reference.cols != small.cols)
+            return -1.0f;
+        uint64_t total = 0;
+        for (int y = 0; y < small.rows; y++) {
+            const uchar* a = small.ptr<uchar>(y);
+            const uchar* b = this->reference.ptr<uchar>(y);
+            for (int x = 0; x < small.cols; x++)
+                total += std::abs(static_cast<int>(a[x]) - static_cast<int>(b[x]));
+        }
+        return static_cast<float>(total) / (static_cast<float>(small.rows) * small.cols);
+    }
+    InferenceDecision decided(InferenceDecision decision, const cv::Mat& small, double nowMs) {
+        this->decisions[static_cast<int>(decision)] += 1;
+        if (decision == InferenceDecision::Run || decision == InferenceDecision::SceneChange) {
+            small.copyTo(this->reference);
+            this->lastRunMs = nowMs;
+        }
+        return decision;
+    }
+public:
+    InferenceScheduler(const SchedulerConfig& config = SchedulerConfig()) : config(config) {}
+
+    bool enabled() const {
+        return this->config.enabled;
+    }
+
+    InferenceDecision decide(const cv::Mat& small, float blur, float gyroRate, bool moving, double nowMs) {
+        if (!this->config.enabled)
+            return InferenceDecision::Run;
+        float diff = difference(small);
+        if (diff < 0.0f || diff >= this->config.changeDifference) // A changed frame size (turn crop) counts as a change too
+            return decided(InferenceDecision::SceneChange, small, nowMs);
+
+        if (gyroRate > this->config.swingGyro && !this->sharpness.empty() && blur < this->config.blurRatio * this->sharpness.median())
+            return decided(InferenceDecision::SkipBlur, small, nowMs);
+        this->sharpness.push(blur);
+
+        if (diff < this->config.staticDifference && gyroRate < this->config.quietGyro && !moving
+            && nowMs - this->lastRunMs < this->config.staticIntervalMs)
+            return decided(InferenceDecision::SkipStatic, small, nowMs);
+        return decided(InferenceDecision::Run, small, nowMs);
+    }
+
+    // --- Statistics ---
+    uint64_t count(InferenceDecision decision) const {
+        return this->decisions[static_cast<int>(decision)];
+    }
+    uint64_t skipped() const {
+        return count(InferenceDecision::SkipStatic) + count(InferenceDecision::SkipBlur);
+    }
+    void log_stats() const {
+        if (!this->config.enabled)
+            return;
+        uint64_t total = skipped() + count(InferenceDecision::Run) + count(InferenceDecision::SceneChange);
+        BOOST_LOG_TRIVIAL(info) << "Inference scheduler skipped " << skipped() << " of " << total << " frames ("
+                                << count(InferenceDecision::SkipStatic) << " static, " << count(InferenceDecision::SkipBlur)
+                                << " motion blurred); " << count(InferenceDecision::SceneChange) << " scene changes.";
+    }
+};
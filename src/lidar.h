@@ -20,15 +20,17 @@
 */
 #pragma once
 #include <linux/types.h>
-#include <linux/i2c-dev.h>
-#include <sys/ioctl.h>
-#include <fcntl.h>
-#include <unistd.h>
 #include <stdio.h>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <thread>
 #include <boost/log/core.hpp>
 #include <boost/log/trivial.hpp>
 
+#include "i2c_bus.h"
+#include "metrics.h"
+
 #define LIDARLite_v3_h
 
 // LIDAR-Lite default I2C device address
@@ -40,6 +42,7 @@
 #define LLv3_SIG_CNT_VAL   0x02
 #define LLv3_ACQ_CONFIG    0x04
 #define LLv3_DISTANCE      0x0f
+#define LLv3_OUTER_LOOP    0x11
 #define LLv3_REF_CNT_VAL   0x12
 #define LLv3_UNIT_ID_HIGH  0x16
 #define LLv3_UNIT_ID_LOW   0x17
@@ -50,10 +53,58 @@
 #define LLv3_I2C_CONFIG    0x1e
 #define LLv3_COMMAND       0x40
 #define LLv3_CORR_DATA     0x52
+#define LLv3_MEASURE_DELAY 0x45
 #define LLv3_ACQ_SETTINGS  0x5d
 
-class LidarLite_v3 {
-    __u32 file_i2c;
+// What the distance thread needs from a range sensor, so recorded data can stand in for the hardware
+class RangeSensor {
+public:
+    virtual ~RangeSensor() {}
+    
+    virtual bool i2c_init(void) = 0;
+    virtual __u8 getBusyFlag(__u8 lidarliteAddress = LIDARLITE_ADDR_DEFAULT) = 0;
+    virtual void takeRange(__u8 lidarliteAddress = LIDARLITE_ADDR_DEFAULT) = 0;
+    virtual __u16 readDistance(__u8 lidarliteAddress = LIDARLITE_ADDR_DEFAULT) = 0;
+    
+    virtual bool next_distance(__u16& distance) {
+        // Non-blocking poll: a new measurement if the sensor is idle, false otherwise
+        if (getBusyFlag() != 0x00)
+            return false;
+        takeRange();
+        distance = readDistance();
+        return true;
+    }
+};
+
+class LidarLite_v3 : public RangeSensor {
+    typedef std::chrono::steady_clock Clock;
+    
+    static constexpr double MIN_CONVERSION_US = 200.0;
+    static constexpr double BUSY_BACKOFF_US = 100.0;  // Re-check interval once the predicted conversion time has passed
+    static constexpr double BUSY_TIMEOUT_US = 100000.0;
+    static constexpr double STALE_RANGE_US = 100000.0; // A pipelined measurement older than this is retaken
+    
+    static const int I2C_BUS = 1;
+    
+    I2CBus* bus = nullptr;  // Shared arbiter of /dev/i2c-1
+    int device = -1;
+    
+    // --- Acquisition engine ---
+    double conversionUs = 1000.0; // Learned conversion time of a single measurement
+    bool ranging = false;
+    Clock::time_point rangeStarted;
+    bool bursting = false;
+    Clock::duration burstPeriod;
+    Clock::time_point nextSample;
+    
+    void start_range() {
+        takeRange();
+        this->rangeStarted = Clock::now();
+        this->ranging = true;
+    }
+    static double elapsed_us(Clock::time_point start) {
+        return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    }
     
 public:
     LidarLite_v3() {
@@ -61,26 +112,18 @@ public:
     }
     ~LidarLite_v3() {
         BOOST_LOG_TRIVIAL(info) << "Destructing Lidar class...";
+        if (this->bursting)
+            stop_burst();
     }
 
     bool i2c_init(void) {
-        char *filename = (char*)"/dev/i2c-1";
-
-        if ((this->file_i2c = open(filename, O_RDWR)) < 0) {
+        this->bus = I2CBus::open(I2C_BUS);
+        if (this->bus == nullptr) {
            BOOST_LOG_TRIVIAL(error) << "Failed to open the i2c bus; Aborting.";
             return false;
         }
         else {
-            return true;
-        }
-    }
-    
-    bool i2c_connect(__u8 lidarliteAddress = LIDARLITE_ADDR_DEFAULT) {
-        if (ioctl(this->file_i2c, I2C_SLAVE, lidarliteAddress) < 0) {
-            BOOST_LOG_TRIVIAL(info) << "Failed to acquire bus access and/or talk to slave; Aborting.";
-            return false;
-        }
-        else {
+            this->device = this->bus->register_device("LidarLite_v3", LIDARLITE_ADDR_DEFAULT, BusPriority::Normal);
             return true;
         }
     }
@@ -182,6 +225,86 @@ public:
         return ((distBytes[0] << 8) | distBytes[1]);
     }
     
+    // --- Timed acquisition ---
+    bool next_distance(__u16& distance) {
+        // Blocks until the next measurement is due. Single-shot mode sleeps through the learned conversion time instead
+        // of polling the status register, and starts the following measurement right after the readback; burst mode
+        // lets the sensor free-run and reads the distance register once per measurement period.
+        if (this->bursting) {
+            Clock::time_point now = Clock::now();
+            if (this->nextSample + this->burstPeriod < now) // Fell behind; resume the cadence from now instead of catching up
+                this->nextSample = now;
+            std::this_thread::sleep_until(this->nextSample);
+            this->nextSample += this->burstPeriod;
+            StageTimer timer(Stage::LidarAcquire);
+            distance = readDistance();
+            return true;
+        }
+        
+        if (!this->ranging || elapsed_us(this->rangeStarted) > STALE_RANGE_US)
+            start_range();
+        std::this_thread::sleep_until(this->rangeStarted + std::chrono::microseconds(static_cast<long>(this->conversionUs)));
+        bool readyOnFirstCheck = true;
+        while (getBusyFlag()) {
+            readyOnFirstCheck = false;
+            if (elapsed_us(this->rangeStarted) > BUSY_TIMEOUT_US) {
+                this->ranging = false;
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long>(BUSY_BACKOFF_US)));
+        }
+        // Creep towards the shortest wait that still finds the sensor idle; jump up when it was still busy
+        if (readyOnFirstCheck)
+            this->conversionUs = this->conversionUs * 0.95 > MIN_CONVERSION_US ? this->conversionUs * 0.95 : MIN_CONVERSION_US;
+        else
+            this->conversionUs = elapsed_us(this->rangeStarted);
+        
+        distance = readDistance();
+        Metrics::global().record(Stage::LidarAcquire, elapsed_us(this->rangeStarted));
+        start_range();
+        return true;
+    }
+    
+    void start_burst(unsigned int rateHz = 0, __u8 lidarliteAddress = LIDARLITE_ADDR_DEFAULT) {
+        // Free-running mode: the sensor measures continuously, so only the distance read touches the bus.
+        // rateHz = 0 keeps the sensor's default repetition rate (about 100 Hz).
+        __u8 dataByte = 0xff;
+        i2cWrite(LLv3_OUTER_LOOP, &dataByte, 1, lidarliteAddress);
+        
+        __u8 acqConfig = 0;
+        i2cRead(LLv3_ACQ_CONFIG, &acqConfig, 1, lidarliteAddress);
+        if (rateHz > 0) {
+            dataByte = static_cast<__u8>(std::min(255u, std::max(1u, 2000u / rateHz))); // 0.5 ms per step
+            i2cWrite(LLv3_MEASURE_DELAY, &dataByte, 1, lidarliteAddress);
+            acqConfig |= 0x20;
+        } else
+            acqConfig &= ~0x20;
+        i2cWrite(LLv3_ACQ_CONFIG, &acqConfig, 1, lidarliteAddress);
+        
+        takeRange(lidarliteAddress);
+        double periodUs = rateHz > 0 ? 1000000.0 / rateHz : 10000.0;
+        this->burstPeriod = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::micro>(periodUs));
+        this->nextSample = Clock::now() + this->burstPeriod;
+        this->bursting = true;
+        this->ranging = false;
+        BOOST_LOG_TRIVIAL(info) << "Lidar free-running at " << 1000000.0 / periodUs << " Hz.";
+    }
+    void stop_burst(__u8 lidarliteAddress = LIDARLITE_ADDR_DEFAULT) {
+        __u8 dataByte = 0x01;
+        i2cWrite(LLv3_OUTER_LOOP, &dataByte, 1, lidarliteAddress);
+        __u8 acqConfig = 0;
+        i2cRead(LLv3_ACQ_CONFIG, &acqConfig, 1, lidarliteAddress);
+        acqConfig &= ~0x20;
+        i2cWrite(LLv3_ACQ_CONFIG, &acqConfig, 1, lidarliteAddress);
+        this->bursting = false;
+    }
+    bool is_bursting() const {
+        return this->bursting;
+    }
+    double conversion_us() const {
+        return this->conversionUs;
+    }
+    
     void waitForBusy(__u8 lidarliteAddress = LIDARLITE_ADDR_DEFAULT) {
         __u8  busyFlag;
 
@@ -208,32 +331,27 @@ public:
     }
     
     __s32 i2cWrite(__u8 regAddr, __u8 * dataBytes, __u8 numBytes, __u8 lidarliteAddress = LIDARLITE_ADDR_DEFAULT) {
-        __u8 buffer[2];
+        // One register write per message, all submitted as a single bus transaction
+        __u8 buffers[I2C_RDWR_IOCTL_MAX_MSGS][2];
+        struct i2c_msg messages[I2C_RDWR_IOCTL_MAX_MSGS];
         __u8 i;
-        __s32 result;
     
-        if (!i2c_connect(lidarliteAddress)) {
+        if (numBytes > I2C_RDWR_IOCTL_MAX_MSGS)
             return -1;
-        }
-
         for (i = 0; i < numBytes; i++) {
-            buffer[0] = regAddr + i;
-            buffer[1] = dataBytes[i];
-            result   |= write(this->file_i2c, buffer, 2);
+            buffers[i][0] = regAddr + i;
+            buffers[i][1] = dataBytes[i];
+            messages[i].addr = lidarliteAddress;
+            messages[i].flags = 0;
+            messages[i].len = 2;
+            messages[i].buf = buffers[i];
         }
 
-        return result;
+        return this->bus->transfer(this->device, messages, numBytes) ? 2 * numBytes : -1;
     }
     
     __s32 i2cRead(__u8 regAddr, __u8 * dataBytes, __u8 numBytes, __u8 lidarliteAddress = LIDARLITE_ADDR_DEFAULT) {
-        __u8 buffer;
-
-        i2c_connect(lidarliteAddress);
-
-        buffer = regAddr;
-
-        write(file_i2c, &buffer, 1);
-        return read(this->file_i2c, dataBytes, numBytes);
+        return this->bus->read_registers(this->device, lidarliteAddress, regAddr, dataBytes, numBytes) ? numBytes : -1;
     }
     
     void correlationRecordRead(__s16 * correlationArray, __u16 numberOfReadings = 256, __u8 lidarliteAddress = LIDARLITE_ADDR_DEFAULT) {
@@ -248,17 +366,37 @@ public:
         dataBytes[0] = 0x07;
         i2cWrite(LLv3_COMMAND, dataBytes, 1, lidarliteAddress);
 
-        for (i = 0; i < numberOfReadings; i++) {
-            i2cRead((LLv3_CORR_DATA | 0x80), dataBytes, 2, lidarliteAddress);
+        // Every read pops the next record entry, so each needs its own write/read pair; send as many pairs per
+        // transaction as fit, at bulk priority so IMU reads can cut in between
+        const __u16 pairsPerTransfer = I2C_RDWR_IOCTL_MAX_MSGS / 2;
+        __u8 corrRegister = LLv3_CORR_DATA | 0x80;
+        __u8 records[I2C_RDWR_IOCTL_MAX_MSGS / 2][2];
+        struct i2c_msg messages[I2C_RDWR_IOCTL_MAX_MSGS];
+        for (i = 0; i < numberOfReadings; ) {
+            __u16 pairs = std::min<__u16>(pairsPerTransfer, numberOfReadings - i);
+            for (__u16 k = 0; k < pairs; k++) {
+                messages[2 * k].addr = lidarliteAddress;
+                messages[2 * k].flags = 0;
+                messages[2 * k].len = 1;
+                messages[2 * k].buf = &corrRegister;
+                messages[2 * k + 1].addr = lidarliteAddress;
+                messages[2 * k + 1].flags = I2C_M_RD;
+                messages[2 * k + 1].len = 2;
+                messages[2 * k + 1].buf = records[k];
+            }
+            if (!this->bus->transfer(this->device, messages, 2 * pairs, BusPriority::Bulk))
+                memset(records, 0, sizeof(records));
 
-            correlationValuePtr[0] = dataBytes[0];
+            for (__u16 k = 0; k < pairs; k++, i++) {
+                correlationValuePtr[0] = records[k][0];
 
-            if (dataBytes[1])
-                correlationValuePtr[1] = 0xff;
-            else
-                correlationValuePtr[1] = 0x00;
+                if (records[k][1])
+                    correlationValuePtr[1] = 0xff;
+                else
+                    correlationValuePtr[1] = 0x00;
 
-            correlationArray[i] = correlationValue;
+                correlationArray[i] = correlationValue;
+            }
         }
 
         dataBytes[0] = 0;
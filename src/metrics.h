@@ -0,0 +1,245 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// --- Pipeline instrumentation ---
+// Latency histograms per pipeline stage and a few event counters. Every recording thread gets its own shard of them,
+// so recording never takes a lock and never writes a cache line another thread writes; the exporter sums the shards.
+// Exported as Prometheus text by MetricsExporter.
+
+enum class Stage : int {
+    Capture,         // Reading a camera frame
+    ImuRead,         // Motion sensor burst read
+    ImageClass,      // Day/night classification
+    Laplacian,       // Blur score
+    Detect,          // Network forward pass
+    RulePass,        // Class rules and tracker
+    WarningDispatch, // Warning scheduler dispatch
+    LidarAcquire,    // Range start (or burst read) until the distance is read back
+    AudioStart,      // Play request until the sample is mixed
+    FrameAge,        // Capture until the preprocessing stage takes the frame
+    COUNT
+};
+enum class Counter : int {FramesCaptured, NetworkPasses, InferenceSkips, WarningsPlayed, LidarReadings, COUNT};
+
+// Log-linear histogram of microsecond values in the spirit of HdrHistogram: 16 sub-buckets per power of two, so any
+// recorded value is reported within 1/16 (6 %) of its true value, from 1 us up to several hours.
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int OCTAVES = 32;
+    static const int BUCKETS = SUB_BUCKETS + OCTAVES * SUB_BUCKETS;
+private:
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sumUs;
+    std::atomic<uint64_t> maxUs;
+public:
+    LatencyHistogram() : total(0), sumUs(0), maxUs(0) {
+        for (int i = 0; i < BUCKETS; i++)
+            this->buckets[i].store(0, std::memory_order_relaxed);
+    }
+
+    static int bucket_of(uint64_t us) {
+        if (us < static_cast<uint64_t>(SUB_BUCKETS))
+            return static_cast<int>(us);
+        int exponent = 63 - __builtin_clzll(us); // >= SUB_BITS
+        int octave = std::min(exponent - SUB_BITS, OCTAVES - 1);
+        int sub = static_cast<int>((us >> (octave)) & (SUB_BUCKETS - 1));
+        return SUB_BUCKETS + octave * SUB_BUCKETS + sub;
+    }
+    static uint64_t bucket_upper_us(int bucket) {
+        // Exclusive upper bound of the values a bucket holds
+        if (bucket < SUB_BUCKETS)
+            return bucket + 1;
+        int octave = (bucket - SUB_BUCKETS) / SUB_BUCKETS, sub = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+        return static_cast<uint64_t>(SUB_BUCKETS + sub + 1) << octave;
+    }
+
+    void record(double us) {
+        uint64_t value = us > 0.0 ? static_cast<uint64_t>(us) : 0;
+        this->buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        this->total.fetch_add(1, std::memory_order_relaxed);
+        this->sumUs.fetch_add(value, std::memory_order_relaxed);
+        uint64_t seen = this->maxUs.load(std::memory_order_relaxed);
+        while (value > seen && !this->maxUs.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+    }
+    void merge(const LatencyHistogram& other) {
+        // Adds another histogram's samples; only meant for a private histogram nobody records into
+        for (int i = 0; i < BUCKETS; i++)
+            this->buckets[i].store(bucket_count(i) + other.bucket_count(i), std::memory_order_relaxed);
+        this->total.store(count() + other.count(), std::memory_order_relaxed);
+        this->sumUs.store(sum_us() + other.sum_us(), std::memory_order_relaxed);
+        this->maxUs.store(std::max(max_us(), other.max_us()), std::memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        return this->total.load(std::memory_order_relaxed);
+    }
+    uint64_t bucket_count(int bucket) const {
+        return this->buckets[bucket].load(std::memory_order_relaxed);
+    }
+    uint64_t sum_us() const {
+        return this->sumUs.load(std::memory_order_relaxed);
+    }
+    uint64_t max_us() const {
+        return this->maxUs.load(std::memory_order_relaxed);
+    }
+    double mean_us() const {
+        uint64_t n = count();
+        return n ? static_cast<double>(sum_us()) / n : 0.0;
+    }
+    double percentile_us(double p) const {
+        // Upper bound of the bucket holding the p-quantile, capped by the largest value seen
+        uint64_t n = count();
+        if (n == 0)
+            return 0.0;
+        uint64_t rank = static_cast<uint64_t>(p * n), seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += bucket_count(i);
+            if (seen > rank)
+                return static_cast<double>(std::min(bucket_upper_us(i), max_us()));
+        }
+        return static_cast<double>(max_us());
+    }
+};
+
+class Metrics {
+private:
+    // Capture, preprocessing, inference, main, distance and audio threads record; further threads share the last
+    // shard, which stays correct as every field is atomic
+    static const int SHARDS = 8;
+
+    struct alignas(64) Shard {
+        LatencyHistogram stages[static_cast<int>(Stage::COUNT)];
+        std::atomic<uint64_t> counters[static_cast<int>(Counter::COUNT)];
+
+        Shard() {
+            for (int i = 0; i < static_cast<int>(Counter::COUNT); i++)
+                this->counters[i].store(0, std::memory_order_relaxed);
+        }
+    };
+    Shard shards[SHARDS];
+    std::atomic<int> nextShard;
+    std::mutex collectorsMutex;
+    std::vector<std::function<void(std::ostream&)>> collectors;
+
+    Metrics() : nextShard(0) {}
+
+    Shard& local() {
+        // Shard of the calling thread, assigned on its first recording
+        static thread_local int index = -1;
+        if (index < 0)
+            index = std::min(this->nextShard.fetch_add(1, std::memory_order_relaxed), SHARDS - 1);
+        return this->shards[index];
+    }
+public:
+    static Metrics& global() {
+        static Metrics instance;
+        return instance;
+    }
+    static const char* stage_name(Stage stage) {
+        static const char* names[] = {"capture", "imu_read", "image_class", "laplacian", "detect", "rule_pass",
+                                      "warning_dispatch", "lidar_acquire", "audio_start", "frame_age"};
+        return names[static_cast<int>(stage)];
+    }
+    static const char* counter_name(Counter counter) {
+        static const char* names[] = {"frames_captured", "network_passes", "inference_skips", "warnings_played", "lidar_readings"};
+        return names[static_cast<int>(counter)];
+    }
+
+    void record(Stage stage, double us) {
+        local().stages[static_cast<int>(stage)].record(us);
+    }
+    void add(Counter counter, uint64_t n = 1) {
+        local().counters[static_cast<int>(counter)].fetch_add(n, std::memory_order_relaxed);
+    }
+    void add_collector(const std::function<void(std::ostream&)>& collector) {
+        // Components that keep their own statistics (the I2C buses) append them to every export
+        std::lock_guard<std::mutex> lock(this->collectorsMutex);
+        this->collectors.push_back(collector);
+    }
+    void histogram(Stage stage, LatencyHistogram& out) const {
+        // Adds the samples of every thread to out
+        for (const Shard& shard : this->shards)
+            out.merge(shard.stages[static_cast<int>(stage)]);
+    }
+    uint64_t counter(Counter counter) const {
+        uint64_t total = 0;
+        for (const Shard& shard : this->shards)
+            total += shard.counters[static_cast<int>(counter)].load(std::memory_order_relaxed);
+        return total;
+    }
+
+    std::string prometheus_text() {
+        // Text exposition format 0.0.4. The histogram is reported at power-of-two boundaries (2^k us) to keep the
+        // output short; the quantiles come from the full resolution buckets.
+        std::unique_ptr<LatencyHistogram[]> merged(new LatencyHistogram[static_cast<int>(Stage::COUNT)]);
+        for (int s = 0; s < static_cast<int>(Stage::COUNT); s++)
+            histogram(static_cast<Stage>(s), merged[s]);
+        std::ostringstream out;
+        out << "# HELP guide_stage_latency_seconds Latency of a pipeline stage.\n"
+            << "# TYPE guide_stage_latency_seconds histogram\n";
+        for (int s = 0; s < static_cast<int>(Stage::COUNT); s++) {
+            const LatencyHistogram& h = merged[s];
+            const char* name = stage_name(static_cast<Stage>(s));
+            uint64_t cumulative = 0;
+            int bucket = 0;
+            for (int k = 0; k <= LatencyHistogram::SUB_BITS + LatencyHistogram::OCTAVES; k++) {
+                uint64_t bound = 1ull << k;
+                while (bucket < LatencyHistogram::BUCKETS && LatencyHistogram::bucket_upper_us(bucket) <= bound)
+                    cumulative += h.bucket_count(bucket++);
+                if (k >= 4 && k <= 25) // 16 us .. 33 s
+                    out << "guide_stage_latency_seconds_bucket{stage=\"" << name << "\",le=\"" << bound * 1e-6 << "\"} " << cumulative << "\n";
+            }
+            out << "guide_stage_latency_seconds_bucket{stage=\"" << name << "\",le=\"+Inf\"} " << h.count() << "\n"
+                << "guide_stage_latency_seconds_sum{stage=\"" << name << "\"} " << h.sum_us() * 1e-6 << "\n"
+                << "guide_stage_latency_seconds_count{stage=\"" << name << "\"} " << h.count() << "\n";
+        }
+        out << "# HELP guide_stage_latency_quantile_seconds Latency quantiles of a pipeline stage (max is quantile 1).\n"
+            << "# TYPE guide_stage_latency_quantile_seconds gauge\n";
+        for (int s = 0; s < static_cast<int>(Stage::COUNT); s++) {
+            const LatencyHistogram& h = merged[s];
+            const char* name = stage_name(static_cast<Stage>(s));
+            out << "guide_stage_latency_quantile_seconds{stage=\"" << name << "\",quantile=\"0.5\"} " << h.percentile_us(0.5) * 1e-6 << "\n"
+                << "guide_stage_latency_quantile_seconds{stage=\"" << name << "\",quantile=\"0.99\"} " << h.percentile_us(0.99) * 1e-6 << "\n"
+                << "guide_stage_latency_quantile_seconds{stage=\"" << name << "\",quantile=\"1\"} " << h.max_us() * 1e-6 << "\n";
+        }
+        for (int c = 0; c < static_cast<int>(Counter::COUNT); c++) {
+            const char* name = counter_name(static_cast<Counter>(c));
+            out << "# TYPE guide_" << name << "_total counter\n"
+                << "guide_" << name << "_total " << counter(static_cast<Counter>(c)) << "\n";
+        }
+        std::vector<std::function<void(std::ostream&)>> extra;
+        {
+            // Called without the lock, so a collector may take locks of its own that are held while registering
+            std::lock_guard<std::mutex> lock(this->collectorsMutex);
+            extra = this->collectors;
+        }
+        for (auto& collector : extra)
+            collector(out);
+        return out.str();
+    }
+};
+
+// Records the lifetime of the object as one sample of a stage
+class StageTimer {
+private:
+    Stage stage;
+    std::chrono::steady_clock::time_point start;
+public:
+    explicit StageTimer(Stage stage) : stage(stage), start(std::chrono::steady_clock::now()) {}
+    ~StageTimer() {
+        Metrics::global().record(this->stage, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - this->start).count());
+    }
+};
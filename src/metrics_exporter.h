@@ -0,0 +1,139 @@
+#pragma once
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+
+#include "metrics.h"
+
+// Publishes Metrics::global() in Prometheus text format: rewritten to a file every intervalMs (via a temporary file
+// and rename, so a reader never sees half a snapshot) and, if a port is given, served over HTTP on 127.0.0.1 only.
+// One background thread does both; it sleeps in poll() on the listening socket between exports.
+class MetricsExporter {
+private:
+    std::string path;
+    double intervalMs = 5000.0;
+    int port = 0;
+    int listenFd = -1;
+    std::atomic<bool> running;
+    std::thread worker;
+
+    static const int STOP_CHECK_MS = 200; // Longest a stop() waits for the thread to notice
+
+    bool open_socket() {
+        this->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (this->listenFd < 0)
+            return false;
+        int reuse = 1;
+        setsockopt(this->listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(static_cast<uint16_t>(this->port));
+        if (bind(this->listenFd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0 || listen(this->listenFd, 4) < 0) {
+            close(this->listenFd);
+            this->listenFd = -1;
+            return false;
+        }
+        return true;
+    }
+    void write_file() {
+        std::string temporary = this->path + ".tmp";
+        {
+            std::ofstream out(temporary, std::ios::trunc);
+            if (!out.is_open())
+                return;
+            out << Metrics::global().prometheus_text();
+        }
+        std::rename(temporary.c_str(), this->path.c_str());
+    }
+    void serve(int client) {
+        // Any request gets the current snapshot; the request itself is read only so the client sees a clean close
+        char request[1024];
+        struct pollfd readable = {client, POLLIN, 0};
+        if (poll(&readable, 1, 100) > 0)
+            (void)!recv(client, request, sizeof(request), 0);
+        std::string body = Metrics::global().prometheus_text();
+        std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                               + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        std::size_t sent = 0;
+        while (sent < response.size()) {
+            ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            sent += n;
+        }
+        close(client);
+    }
+    void run() {
+        auto nextExport = std::chrono::steady_clock::now();
+        while (this->running) {
+            auto now = std::chrono::steady_clock::now();
+            if (!this->path.empty() && now >= nextExport) {
+                write_file();
+                nextExport = now + std::chrono::microseconds(static_cast<long>(this->intervalMs * 1000.0));
+            }
+            int waitMs = STOP_CHECK_MS;
+            if (!this->path.empty()) {
+                long untilExport = std::chrono::duration_cast<std::chrono::milliseconds>(nextExport - now).count();
+                waitMs = static_cast<int>(std::max(0L, std::min(untilExport, static_cast<long>(waitMs))));
+            }
+            if (this->listenFd < 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(waitMs));
+                continue;
+            }
+            struct pollfd incoming = {this->listenFd, POLLIN, 0};
+            if (poll(&incoming, 1, waitMs) > 0) {
+                int client = accept(this->listenFd, nullptr, nullptr);
+                if (client >= 0)
+                    serve(client);
+            }
+        }
+        if (!this->path.empty())
+            write_file(); // Final snapshot of the run
+    }
+public:
+    MetricsExporter() : running(false) {}
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+    ~MetricsExporter() {
+        stop();
+    }
+
+    bool start(const std::string& path, double intervalMs, int port) {
+        // path may be empty (no file), port 0 (no endpoint)
+        this->path = path;
+        this->intervalMs = intervalMs;
+        this->port = port;
+        if (port > 0 && !open_socket()) {
+            BOOST_LOG_TRIVIAL(error) << "Unable to serve metrics on 127.0.0.1:" << port;
+            return false;
+        }
+        this->running = true;
+        this->worker = std::thread(&MetricsExporter::run, this);
+        BOOST_LOG_TRIVIAL(info) << "Exporting metrics" << (path.empty() ? "" : " to " + path)
+                                << (port > 0 ? " on http://127.0.0.1:" + std::to_string(port) + "/metrics" : "") << ".";
+        return true;
+    }
+    void stop() {
+        if (!this->running.exchange(false))
+            return;
+        if (this->worker.joinable())
+            this->worker.join();
+        if (this->listenFd >= 0)
+            close(this->listenFd);
+        this->listenFd = -1;
+    }
+};
@@ -0,0 +1,99 @@
+#pragma once
+#include "net.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+
+// Keeps a single Network resident for the whole run. Day/night and standby transitions only pause and resume
+// inference, so the prototxt/caffemodel are parsed once and no weights are reallocated on a switch.
+class ModelManager {
+private:
+    Network network;
+    bool loaded = false;
+    std::atomic<bool> paused;
+
+    bool switchPending = false;
+    std::chrono::steady_clock::time_point switchStart;
+    double lastSwitchMs = 0.0;
+public:
+    ModelManager(std::string modelConfig, std::string modelBin) : network(modelConfig, modelBin), paused(false) {
+        BOOST_LOG_TRIVIAL(info) << "Constructing model manager class...";
+    }
+    ~ModelManager() {
+        BOOST_LOG_TRIVIAL(info) << "Destructing model manager class...";
+    }
+
+    void load() {
+        if (this->loaded)
+            return;
+        auto start = std::chrono::steady_clock::now();
+        this->network.initialize();
+        warm_up();
+        this->loaded = true;
+        BOOST_LOG_TRIVIAL(info) << "Model loaded and warmed up in " << elapsed_ms(start) << " ms; resident memory " << resident_memory_kb() << " kB.";
+    }
+    void warm_up() {
+        // The first forward pass allocates layer buffers and (on CUDA) compiles kernels; pay for it before the first real frame
+        cv::Mat dummy(300, 300, CV_8UC3, cv::Scalar(127, 127, 127));
+        this->network.detect(dummy);
+    }
+
+    // --- Inference control ---
+    void pause() {
+        if (this->paused.exchange(true))
+            return;
+        BOOST_LOG_TRIVIAL(info) << "Inference paused; resident memory " << resident_memory_kb() << " kB.";
+    }
+    void resume() {
+        if (!this->paused.exchange(false))
+            return;
+        this->switchPending = true;
+        this->switchStart = std::chrono::steady_clock::now();
+    }
+    void set_active(bool active) {
+        if (active)
+            resume();
+        else
+            pause();
+    }
+    bool is_active() const {
+        return this->loaded && !this->paused;
+    }
+
+    cv::Mat detect_blob(const cv::Mat& blob) {
+        cv::Mat detections = this->network.detect_blob(blob);
+        if (this->switchPending) { // Switch latency: resume request until the first detection is available
+            this->switchPending = false;
+            this->lastSwitchMs = elapsed_ms(this->switchStart);
+            BOOST_LOG_TRIVIAL(info) << "Inference resumed; first detection after " << this->lastSwitchMs << " ms, resident memory " << resident_memory_kb() << " kB.";
+        }
+        return detections;
+    }
+    Network& get_network() {
+        return this->network;
+    }
+
+    // --- Statistics ---
+    double last_switch_ms() const {
+        return this->lastSwitchMs;
+    }
+    static long resident_memory_kb() {
+        // VmRSS of this process as reported by the kernel, -1 if unavailable
+        std::ifstream status("/proc/self/status");
+        std::string key;
+        while (status >> key) {
+            if (key == "VmRSS:") {
+                long kb = -1;
+                status >> kb;
+                return kb;
+            }
+            status.ignore(256, '\n');
+        }
+        return -1;
+    }
+    static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+};
@@ -10,6 +10,10 @@
 #include <iostream>
 #include <cstdlib>
 #include <cmath>
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include <vector>
 #include <boost/log/core.hpp>
 #include <boost/log/trivial.hpp>
 
@@ -51,7 +55,7 @@ float empirical_standard_deviation(std::vector<float> &vec) {
     for (std::size_t i = 0; i < vec.size(); i++) {
         mean_val += vec[i];
     }
-    mean_val = mean_val / 15.0f;
+    mean_val = mean_val / (float)vec.size();
     float var_sum = 0;
     for (std::size_t i = 0; i < vec.size(); i++) {
         var_sum += std::pow(vec[i] - mean_val, 2);
@@ -59,14 +63,14 @@ float empirical_standard_deviation(std::vector<float> &vec) {
     return std::sqrt((1.0f / ((float)vec.size() - 1)) * var_sum);
 }
 
-bool vector_contains(std::vector<std::array<int, 4>> vec, int label) {
-    for (unsigned int i = 0; i < vec.size(); i++) {
-        if (vec[i][0] == label)
-            return true;
-    }
-
-    return false;
-}
+// One way of running the net: OpenCV DNN backend/target pair plus the number of CPU threads (0 = OpenCV default)
+struct InferenceBackend {
+    std::string name;
+    int backend;
+    int target;
+    int threads;
+    double latencyMs; // Measured by Network::autotune, -1 if not benchmarked or failed
+};
 
 class Network {
 private:
@@ -74,11 +78,13 @@ private:
     std::string modelBin;
     cv::dnn::Net net;
     cv::Mat detectionMat;
+    InferenceBackend backend = {"opencv-cpu", cv::dnn::DNN_BACKEND_OPENCV, cv::dnn::DNN_TARGET_CPU, 0, -1.0};
+    std::vector<InferenceBackend> benchmarks;
     
-    const std::size_t inWidth = 300;
-    const std::size_t inHeight = 300;
-    const float inScaleFactor = 0.007843f;
-    const float meanVal = 127.5f;
+    static constexpr int inWidth = 300;
+    static constexpr int inHeight = 300;
+    static constexpr float inScaleFactor = 0.007843f;
+    static constexpr float meanVal = 127.5f;
     const float confidenceThreshold = 0.3f;
     
     char classNames[11][19] = {"background", "person", "car", "bus", "bicycle", "motorcycle", "bench", "chair", "bin", "traffiglight_red", "trafficlight_green"};
@@ -94,16 +100,98 @@ public:
         BOOST_LOG_TRIVIAL(info) << "Destructing network class...";
     }
     
-    void initialize() {
+    void initialize(bool tune = true) {
         BOOST_LOG_TRIVIAL(info) << "Initializing network... ";
         this->net = cv::dnn::readNetFromCaffe(modelConfig, modelBin);
-        this->net.setPreferableBackend(cv::dnn::DNN_BACKEND_CUDA); // Activate GPU acceleration
-        this->net.setPreferableTarget(cv::dnn::DNN_TARGET_CUDA);
+        if (tune)
+            autotune();
+        else
+            set_backend(this->backend);
         BOOST_LOG_TRIVIAL(info) << "Done initializing network!";
     }
-    cv::Mat detect(cv::Mat frame) {
-        cv::Mat inputBlob = cv::dnn::blobFromImage(frame, inScaleFactor, cv::Size(inWidth, inHeight), cv::Scalar(meanVal, meanVal, meanVal), false); //Convert Mat to batch of images
+    
+    // --- Backend selection ---
+    static std::vector<InferenceBackend> available_backends() {
+        // Every configuration this OpenCV build can run; CPU is always available as a fallback
+        std::vector<InferenceBackend> candidates;
+        int cores = static_cast<int>(std::thread::hardware_concurrency());
+        
+        std::vector<cv::dnn::Target> cuda = cv::dnn::getAvailableTargets(cv::dnn::DNN_BACKEND_CUDA);
+        for (std::size_t i = 0; i < cuda.size(); i++) {
+            if (cuda[i] == cv::dnn::DNN_TARGET_CUDA)
+                candidates.push_back({"cuda", cv::dnn::DNN_BACKEND_CUDA, cv::dnn::DNN_TARGET_CUDA, 0, -1.0});
+            if (cuda[i] == cv::dnn::DNN_TARGET_CUDA_FP16)
+                candidates.push_back({"cuda-fp16", cv::dnn::DNN_BACKEND_CUDA, cv::dnn::DNN_TARGET_CUDA_FP16, 0, -1.0});
+        }
+        std::vector<cv::dnn::Target> ie = cv::dnn::getAvailableTargets(cv::dnn::DNN_BACKEND_INFERENCE_ENGINE);
+        for (std::size_t i = 0; i < ie.size(); i++) {
+            if (ie[i] == cv::dnn::DNN_TARGET_CPU)
+                candidates.push_back({"inference-engine-cpu", cv::dnn::DNN_BACKEND_INFERENCE_ENGINE, cv::dnn::DNN_TARGET_CPU, 0, -1.0});
+        }
+        candidates.push_back({"opencv-cpu", cv::dnn::DNN_BACKEND_OPENCV, cv::dnn::DNN_TARGET_CPU, cores, -1.0});
+        if (cores > 2)
+            candidates.push_back({"opencv-cpu", cv::dnn::DNN_BACKEND_OPENCV, cv::dnn::DNN_TARGET_CPU, cores / 2, -1.0});
+        return candidates;
+    }
+    void set_backend(const InferenceBackend& config) {
+        this->backend = config;
+        this->net.setPreferableBackend(config.backend);
+        this->net.setPreferableTarget(config.target);
+        cv::setNumThreads(config.threads > 0 ? config.threads : -1); // -1 restores OpenCV's default
+    }
+    void set_threads(int threads) {
+        // Only affects the OpenCV CPU backend; takes effect on the next forward pass
+        this->backend.threads = threads;
+        cv::setNumThreads(threads);
+    }
+    InferenceBackend autotune(int iterations = 5) {
+        // Time every available backend on a synthetic 300x300 frame and keep the fastest one
+        cv::Mat blob = make_blob(cv::Mat(inHeight, inWidth, CV_8UC3, cv::Scalar(127, 127, 127)));
+        std::vector<InferenceBackend> candidates = available_backends();
+        int best = -1;
+        
+        for (std::size_t i = 0; i < candidates.size(); i++) {
+            try {
+                set_backend(candidates[i]);
+                detect_blob(blob); // First pass sets up the backend and is not representative
+                auto start = std::chrono::steady_clock::now();
+                for (int n = 0; n < iterations; n++)
+                    detect_blob(blob);
+                candidates[i].latencyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+            } catch (const cv::Exception& e) {
+                BOOST_LOG_TRIVIAL(warning) << "Backend " << candidates[i].name << " failed: " << e.what();
+                continue;
+            }
+            BOOST_LOG_TRIVIAL(info) << "Backend " << candidates[i].name << " (" << candidates[i].threads << " threads): " << candidates[i].latencyMs << " ms per frame";
+            if (best == -1 || candidates[i].latencyMs < candidates[best].latencyMs)
+                best = i;
+        }
+        
+        this->benchmarks = candidates;
+        if (best == -1) {
+            BOOST_LOG_TRIVIAL(error) << "No inference backend could run the network; Falling back to OpenCV CPU.";
+            set_backend({"opencv-cpu", cv::dnn::DNN_BACKEND_OPENCV, cv::dnn::DNN_TARGET_CPU, 0, -1.0});
+        } else {
+            BOOST_LOG_TRIVIAL(info) << "Selected backend " << candidates[best].name << " (" << candidates[best].threads << " threads, " << candidates[best].latencyMs << " ms per frame).";
+            set_backend(candidates[best]);
+        }
+        return this->backend;
+    }
+    const InferenceBackend& get_backend() const {
+        return this->backend;
+    }
+    const std::vector<InferenceBackend>& get_benchmarks() const {
+        return this->benchmarks;
+    }
 
+    static cv::Mat make_blob(const cv::Mat& frame) {
+        // Static so a preprocessing stage can build the input without touching the net itself
+        return cv::dnn::blobFromImage(frame, inScaleFactor, cv::Size(inWidth, inHeight), cv::Scalar(meanVal, meanVal, meanVal), false); //Convert Mat to batch of images
+    }
+    cv::Mat detect(cv::Mat frame) {
+        return detect_blob(make_blob(frame));
+    }
+    cv::Mat detect_blob(const cv::Mat& inputBlob) {
         net.setInput(inputBlob, "data"); //Set the network input
         cv::Mat detection = net.forward("detection_out");
         cv::Mat detectMat(detection.size[2], detection.size[3], CV_32F, detection.ptr<float>());
@@ -112,6 +200,35 @@ public:
         
         return detectMat;
     }
+    std::vector<cv::Mat> detect_batch(const std::vector<cv::Mat>& frames) {
+        // One NCHW blob and one forward pass for all frames; returns one detection view (rows of 7 floats) per frame.
+        // Like detect(), the views point into the net's output and stay valid until the next forward pass.
+        std::vector<cv::Mat> perImage(frames.size());
+        if (frames.empty())
+            return perImage;
+        
+        cv::Mat inputBlob = cv::dnn::blobFromImages(frames, inScaleFactor, cv::Size(inWidth, inHeight), cv::Scalar(meanVal, meanVal, meanVal), false);
+        net.setInput(inputBlob, "data");
+        cv::Mat detection = net.forward("detection_out");
+        cv::Mat detectMat(detection.size[2], detection.size[3], CV_32F, detection.ptr<float>());
+        
+        // DetectionOutput emits the rows of each image in one contiguous run, tagged with the image index in column 0
+        int row = 0;
+        while (row < detectMat.rows) {
+            int image = static_cast<int>(detectMat.at<float>(row, 0));
+            int end = row + 1;
+            while (end < detectMat.rows && static_cast<int>(detectMat.at<float>(end, 0)) == image)
+                end++;
+            if (image >= 0 && image < static_cast<int>(frames.size()))
+                perImage[image] = detectMat.rowRange(row, end);
+            row = end;
+        }
+        for (std::size_t i = 0; i < perImage.size(); i++) {
+            if (perImage[i].empty()) // Keep the column layout for frames without detections
+                perImage[i] = cv::Mat(0, detectMat.cols, CV_32F);
+        }
+        return perImage;
+    }
     void draw_detections(cv::Mat& frame) {
         for(int i = 0; i < this->detectionMat.rows; i++) {
             float confidence = this->detectionMat.at<float>(i, 2);
@@ -0,0 +1,175 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+
+// --- Pre-decoded voice lines ---
+// One file holding every waveform as raw PCM in the mixer's output format, so startup only memory-maps it:
+//   PcmPackHeader, PcmPackEntry[count], then each waveform at a page-aligned offset
+// The pack is a cache of the WAV files next to it. Each entry remembers the size and mtime of its source, and the
+// pack is rebuilt when the output format or a source file changed.
+
+struct PcmPackHeader {
+    char magic[8];      // "GWPCM\0\0\0"
+    uint32_t version;
+    uint32_t count;
+    int32_t frequency;
+    uint32_t format;    // SDL audio format, e.g. AUDIO_S16SYS
+    int32_t channels;
+    uint32_t reserved;
+};
+struct PcmPackEntry {
+    uint64_t offset;
+    uint32_t length;    // Bytes of PCM, 0 if the source could not be decoded
+    uint32_t reserved;
+    int64_t sourceMtime;
+    uint64_t sourceSize;
+};
+
+class PcmPack {
+private:
+    static constexpr const char* MAGIC = "GWPCM\0\0";
+    static const uint32_t VERSION = 1;
+    static const long PAGE = 4096;
+
+    uint8_t* base = nullptr;
+    size_t mappedBytes = 0;
+    const PcmPackHeader* header = nullptr;
+    const PcmPackEntry* entries = nullptr;
+
+    static bool source_stamp(const std::string& path, int64_t& mtime, uint64_t& size) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            return false;
+        mtime = static_cast<int64_t>(st.st_mtime);
+        size = static_cast<uint64_t>(st.st_size);
+        return true;
+    }
+public:
+    PcmPack() {}
+    PcmPack(const PcmPack&) = delete;
+    PcmPack& operator=(const PcmPack&) = delete;
+    ~PcmPack() {
+        close();
+    }
+
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(PcmPackHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+            return false;
+        this->base = static_cast<uint8_t*>(mapped);
+        this->mappedBytes = st.st_size;
+        this->header = reinterpret_cast<const PcmPackHeader*>(this->base);
+        this->entries = reinterpret_cast<const PcmPackEntry*>(this->base + sizeof(PcmPackHeader));
+
+        bool valid = memcmp(this->header->magic, MAGIC, 8) == 0 && this->header->version == VERSION
+                     && sizeof(PcmPackHeader) + this->header->count * sizeof(PcmPackEntry) <= this->mappedBytes;
+        for (uint32_t i = 0; valid && i < this->header->count; i++)
+            valid = this->entries[i].offset + this->entries[i].length <= this->mappedBytes;
+        if (!valid) {
+            BOOST_LOG_TRIVIAL(warning) << "Ignoring malformed audio pack " << path;
+            close();
+        }
+        return valid;
+    }
+    void close() {
+        if (this->base != nullptr)
+            munmap(this->base, this->mappedBytes);
+        this->base = nullptr;
+        this->mappedBytes = 0;
+        this->header = nullptr;
+        this->entries = nullptr;
+    }
+
+    bool matches(int frequency, uint32_t format, int channels, uint32_t count) const {
+        return this->header != nullptr && this->header->frequency == frequency && this->header->format == format
+               && this->header->channels == channels && this->header->count == count;
+    }
+    bool is_current(uint32_t i, const std::string& sourcePath) const {
+        // A missing source is fine (the pack may be deployed on its own); a changed one is not
+        int64_t mtime;
+        uint64_t size;
+        if (!source_stamp(sourcePath, mtime, size))
+            return true;
+        return this->entries[i].sourceMtime == mtime && this->entries[i].sourceSize == size;
+    }
+
+    uint8_t* data(uint32_t i) const {
+        return this->entries[i].length ? this->base + this->entries[i].offset : nullptr;
+    }
+    uint32_t length(uint32_t i) const {
+        return this->entries[i].length;
+    }
+    void prefault(uint32_t i) const {
+        // Touch every page now, so the first play of this waveform does not take page faults
+        const volatile uint8_t* pcm = data(i);
+        if (pcm == nullptr)
+            return;
+        madvise(const_cast<uint8_t*>(pcm) - (this->entries[i].offset % PAGE), length(i) + this->entries[i].offset % PAGE, MADV_WILLNEED);
+        uint8_t sink = 0;
+        for (uint32_t offset = 0; offset < length(i); offset += PAGE)
+            sink ^= pcm[offset];
+        (void)sink;
+    }
+
+    static bool write(const std::string& path, int frequency, uint32_t format, int channels,
+                      const std::vector<const uint8_t*>& pcm, const std::vector<uint32_t>& lengths, const std::vector<std::string>& sources) {
+        // Written to a temporary file and renamed, so a reader never maps a half-written pack
+        std::string temporary = path + ".tmp";
+        FILE* file = fopen(temporary.c_str(), "wb");
+        if (file == nullptr)
+            return false;
+
+        PcmPackHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MAGIC, 8);
+        header.version = VERSION;
+        header.count = static_cast<uint32_t>(pcm.size());
+        header.frequency = frequency;
+        header.format = format;
+        header.channels = channels;
+
+        std::vector<PcmPackEntry> entries(pcm.size());
+        uint64_t offset = sizeof(PcmPackHeader) + entries.size() * sizeof(PcmPackEntry);
+        for (size_t i = 0; i < pcm.size(); i++) {
+            memset(&entries[i], 0, sizeof(PcmPackEntry));
+            offset = (offset + PAGE - 1) / PAGE * PAGE;
+            entries[i].offset = offset;
+            entries[i].length = pcm[i] != nullptr ? lengths[i] : 0;
+            source_stamp(sources[i], entries[i].sourceMtime, entries[i].sourceSize);
+            offset += entries[i].length;
+        }
+
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+                  && fwrite(entries.data(), sizeof(PcmPackEntry), entries.size(), file) == entries.size();
+        for (size_t i = 0; ok && i < pcm.size(); i++) {
+            ok = fseek(file, static_cast<long>(entries[i].offset), SEEK_SET) == 0;
+            if (ok && entries[i].length)
+                ok = fwrite(pcm[i], 1, entries[i].length, file) == entries[i].length;
+        }
+        ok = fclose(file) == 0 && ok;
+        if (ok)
+            ok = rename(temporary.c_str(), path.c_str()) == 0;
+        if (!ok)
+            unlink(temporary.c_str());
+        return ok;
+    }
+};
@@ -0,0 +1,37 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <vector>
+
+// Per-frame preprocessing shared by the cheap image analytics. One color conversion of the BGR frame produces the
+// full-resolution grayscale image (or a capture delivers it directly); smaller gray levels are derived from it, so no
+// consumer has to touch the BGR frame again (the day/night classifier samples a few thousand BGR pixels itself).
+class FramePyramid {
+private:
+    cv::Mat ownGray; // levels[0] when built from BGR; a capture that delivers luma is used in place instead
+
+    void derive(int numLevels) {
+        for (int i = 1; i < numLevels; i++)
+            cv::pyrDown(this->levels[i - 1], this->levels[i]);
+    }
+public:
+    std::vector<cv::Mat> levels; // levels[0] is the full-resolution gray image, every further level half the size
+
+    void build(const cv::Mat& bgr, int numLevels = 3) {
+        this->levels.resize(numLevels);
+        cv::cvtColor(bgr, this->ownGray, cv::COLOR_BGR2GRAY); // Vectorized (NEON on the Jetson); reuses ownGray's buffer
+        this->levels[0] = this->ownGray;
+        derive(numLevels);
+    }
+    void build_from_gray(const cv::Mat& gray, int numLevels = 3) {
+        // No copy: levels[0] refers to gray, which must outlive the use of the pyramid
+        this->levels.resize(numLevels);
+        this->levels[0] = gray;
+        derive(numLevels);
+    }
+
+    const cv::Mat& gray() const {
+        return this->levels[0];
+    }
+};
@@ -0,0 +1,315 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+
+#include "bounded_queue.h"
+
+// --- Session recording ---
+// A session is two append-only files next to each other:
+//   <prefix>.rec  FileHeader, then records (RecordHeader + payload) in the order they were captured
+//   <prefix>.idx  FileHeader, then one fixed-size IndexEntry per record, so the index can be memory-mapped and
+//                 searched by timestamp without reading the data file
+// Timestamps are steady_clock nanoseconds (monotonic). All disk I/O happens on a background writer thread fed by
+// a bounded queue; the capture and perception threads only enqueue and never wait for the disk.
+
+enum class RecordType : uint32_t {Frame = 1, Imu = 2, Lidar = 3};
+enum class FrameEncoding : uint32_t {Raw = 0, Jpeg = 1};
+
+struct FileHeader {
+    char magic[8];       // "GWREC\0\0\0" or "GWIDX\0\0\0"
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t startNs;    // steady_clock time the session was opened
+};
+struct RecordHeader {
+    uint32_t type;
+    uint32_t size;       // Payload bytes following this header
+    uint64_t timestampNs;
+};
+struct IndexEntry {
+    uint64_t timestampNs;
+    uint64_t offset;     // Offset of the payload in the data file
+    uint32_t type;
+    uint32_t size;
+};
+struct FramePayload {    // Followed by the raw pixels or the encoded image
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t matType;
+    uint32_t encoding;
+};
+struct ImuSample {       // Outputs of the USFS wrappers as used by the main loop
+    float roll, pitch, yaw;
+    float ax, ay, az;
+    float gx, gy, gz;
+    float mx, my, mz;
+    float pressure, temperature, altitude;
+    uint32_t eventStatus;
+};
+struct LidarSample {
+    uint32_t distance;   // cm, as returned by readDistance
+};
+static_assert(sizeof(FileHeader) == 24 && sizeof(RecordHeader) == 16 && sizeof(IndexEntry) == 24, "Session file layout must not depend on padding");
+static_assert(sizeof(FramePayload) == 16 && sizeof(ImuSample) == 64 && sizeof(LidarSample) == 4, "Session file layout must not depend on padding");
+
+static const uint32_t SESSION_VERSION = 1;
+
+inline uint64_t session_clock_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class SessionRecorder {
+private:
+    struct Pending {
+        uint32_t type = 0;
+        uint64_t timestampNs = 0;
+        std::shared_ptr<cv::Mat> frame; // Releasing it (written or dropped) frees a frame slot
+        std::vector<uint8_t> bytes;
+    };
+
+    BoundedQueue<Pending> queue;
+    std::thread writer;
+    std::atomic<bool> closing;
+    std::atomic<int> pendingFrames;
+    std::atomic<uint64_t> droppedFrames;
+    int maxPendingFrames;
+    bool compress;
+    int jpegQuality;
+
+    int dataFd = -1;
+    int indexFd = -1;
+    uint64_t offset = 0;
+    uint64_t written = 0;
+
+    static bool write_all(int fd, const void* buffer, std::size_t size) {
+        const uint8_t* p = static_cast<const uint8_t*>(buffer);
+        while (size > 0) {
+            ssize_t n = ::write(fd, p, size);
+            if (n <= 0)
+                return false;
+            p += n;
+            size -= static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+    bool write_record(uint32_t type, uint64_t timestampNs, const void* head, std::size_t headSize, const void* body, std::size_t bodySize) {
+        RecordHeader header = {type, static_cast<uint32_t>(headSize + bodySize), timestampNs};
+        IndexEntry entry = {timestampNs, this->offset + sizeof(RecordHeader), type, header.size};
+        bool ok = write_all(this->dataFd, &header, sizeof(header)) && write_all(this->dataFd, head, headSize)
+                  && (bodySize == 0 || write_all(this->dataFd, body, bodySize));
+        if (!ok)
+            return false;
+        this->offset += sizeof(RecordHeader) + header.size;
+        // The index entry is written after its payload, so a crash never leaves an entry pointing past the data
+        return write_all(this->indexFd, &entry, sizeof(entry));
+    }
+    void write_pending(Pending& item) {
+        bool ok = true;
+        if (item.type == static_cast<uint32_t>(RecordType::Frame)) {
+            const cv::Mat& frame = *item.frame;
+            FramePayload head = {static_cast<uint32_t>(frame.rows), static_cast<uint32_t>(frame.cols), static_cast<uint32_t>(frame.type()),
+                                 static_cast<uint32_t>(this->compress ? FrameEncoding::Jpeg : FrameEncoding::Raw)};
+            if (this->compress) {
+                std::vector<uchar> encoded;
+                cv::imencode(".jpg", frame, encoded, std::vector<int>{cv::IMWRITE_JPEG_QUALITY, this->jpegQuality});
+                ok = write_record(item.type, item.timestampNs, &head, sizeof(head), encoded.data(), encoded.size());
+            } else
+                ok = write_record(item.type, item.timestampNs, &head, sizeof(head), frame.data, frame.total() * frame.elemSize());
+        } else
+            ok = write_record(item.type, item.timestampNs, item.bytes.data(), item.bytes.size(), nullptr, 0);
+
+        if (ok)
+            this->written += 1;
+        else
+            BOOST_LOG_TRIVIAL(error) << "Failed writing session record: " << std::strerror(errno);
+    }
+    void run() {
+        BOOST_LOG_TRIVIAL(info) << "Starting recorder thread...";
+        Pending item;
+        for (;;) {
+            if (!this->queue.pop(item, std::chrono::milliseconds(100))) {
+                if (this->closing && this->queue.size() == 0)
+                    break;
+                continue;
+            }
+            write_pending(item);
+            item = Pending(); // Release the frame before waiting for the next record
+        }
+        BOOST_LOG_TRIVIAL(info) << "Stopping recorder thread; " << this->written << " records written, " << this->droppedFrames << " frames and "
+                                << this->queue.dropped_count() << " queued records dropped.";
+    }
+    void push_sample(RecordType type, const void* sample, std::size_t size) {
+        Pending item;
+        item.type = static_cast<uint32_t>(type);
+        item.timestampNs = session_clock_ns();
+        item.bytes.assign(static_cast<const uint8_t*>(sample), static_cast<const uint8_t*>(sample) + size);
+        this->queue.push(std::move(item));
+    }
+public:
+    SessionRecorder(bool compress = true, int jpegQuality = 90, int maxPendingFrames = 8, std::size_t capacity = 4096)
+        : queue(capacity, QueuePolicy::DropOldest), closing(false), pendingFrames(0), droppedFrames(0),
+          maxPendingFrames(maxPendingFrames), compress(compress), jpegQuality(jpegQuality) {
+        BOOST_LOG_TRIVIAL(info) << "Constructing session recorder class...";
+    }
+    ~SessionRecorder() {
+        close();
+        BOOST_LOG_TRIVIAL(info) << "Destructing session recorder class...";
+    }
+
+    bool open(const std::string& prefix) {
+        this->dataFd = ::open((prefix + ".rec").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        this->indexFd = ::open((prefix + ".idx").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (this->dataFd < 0 || this->indexFd < 0) {
+            BOOST_LOG_TRIVIAL(error) << "Unable to create session files " << prefix << ".rec/.idx";
+            return false;
+        }
+        FileHeader data = {{'G', 'W', 'R', 'E', 'C', 0, 0, 0}, SESSION_VERSION, 0, session_clock_ns()};
+        FileHeader index = {{'G', 'W', 'I', 'D', 'X', 0, 0, 0}, SESSION_VERSION, 0, data.startNs};
+        if (!write_all(this->dataFd, &data, sizeof(data)) || !write_all(this->indexFd, &index, sizeof(index)))
+            return false;
+        this->offset = sizeof(FileHeader);
+        this->writer = std::thread(&SessionRecorder::run, this);
+        BOOST_LOG_TRIVIAL(info) << "Recording session to " << prefix << ".rec";
+        return true;
+    }
+    void close() {
+        if (this->writer.joinable()) {
+            this->closing = true;
+            this->queue.close(); // Remaining records are still drained
+            this->writer.join();
+        }
+        if (this->dataFd >= 0)
+            ::close(this->dataFd);
+        if (this->indexFd >= 0)
+            ::close(this->indexFd);
+        this->dataFd = this->indexFd = -1;
+    }
+
+    // --- Called from the capture, main and distance threads; never block ---
+    void record_frame(const cv::Mat& frame) {
+        if (frame.empty())
+            return;
+        if (this->pendingFrames.fetch_add(1) >= this->maxPendingFrames) { // Bound the memory held by queued frames
+            this->pendingFrames.fetch_sub(1);
+            this->droppedFrames.fetch_add(1);
+            return;
+        }
+        std::atomic<int>* counter = &this->pendingFrames;
+        Pending item;
+        item.type = static_cast<uint32_t>(RecordType::Frame);
+        item.timestampNs = session_clock_ns();
+        item.frame = std::shared_ptr<cv::Mat>(new cv::Mat(frame.clone()), [counter](cv::Mat* m) {
+            counter->fetch_sub(1);
+            delete m;
+        });
+        this->queue.push(std::move(item));
+    }
+    void record_imu(const ImuSample& sample) {
+        push_sample(RecordType::Imu, &sample, sizeof(sample));
+    }
+    void record_lidar(uint32_t distance) {
+        LidarSample sample = {distance};
+        push_sample(RecordType::Lidar, &sample, sizeof(sample));
+    }
+};
+
+// Random access to a recorded session through read-only memory maps of the data and index files
+class SessionReader {
+private:
+    const uint8_t* data = nullptr;
+    std::size_t dataSize = 0;
+    const uint8_t* index = nullptr;
+    std::size_t indexSize = 0;
+
+    static const uint8_t* map_file(const std::string& path, std::size_t& size) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return nullptr;
+        struct stat info;
+        void* mapped = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size >= static_cast<off_t>(sizeof(FileHeader))) {
+            size = static_cast<std::size_t>(info.st_size);
+            mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        return mapped == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(mapped);
+    }
+public:
+    ~SessionReader() {
+        if (this->data != nullptr)
+            munmap(const_cast<uint8_t*>(this->data), this->dataSize);
+        if (this->index != nullptr)
+            munmap(const_cast<uint8_t*>(this->index), this->indexSize);
+    }
+
+    bool open(const std::string& prefix) {
+        this->data = map_file(prefix + ".rec", this->dataSize);
+        this->index = map_file(prefix + ".idx", this->indexSize);
+        if (this->data == nullptr || this->index == nullptr)
+            return false;
+        return std::memcmp(this->data, "GWREC", 5) == 0 && std::memcmp(this->index, "GWIDX", 5) == 0;
+    }
+
+    std::size_t size() const {
+        return (this->indexSize - sizeof(FileHeader)) / sizeof(IndexEntry);
+    }
+    const IndexEntry& entry(std::size_t i) const {
+        return reinterpret_cast<const IndexEntry*>(this->index + sizeof(FileHeader))[i];
+    }
+    std::size_t find(uint64_t timestampNs) const {
+        // First record at or after timestampNs (records are indexed in capture order)
+        const IndexEntry* first = reinterpret_cast<const IndexEntry*>(this->index + sizeof(FileHeader));
+        const IndexEntry* last = first + size();
+        return std::lower_bound(first, last, timestampNs, [](const IndexEntry& e, uint64_t t) { return e.timestampNs < t; }) - first;
+    }
+    const uint8_t* payload(const IndexEntry& e) const {
+        // nullptr if the entry points past the end of the data file (e.g. a truncated copy)
+        return e.offset + e.size <= this->dataSize ? this->data + e.offset : nullptr;
+    }
+
+    bool read_frame(const IndexEntry& e, cv::Mat& frame) const {
+        // Raw frames are returned as a view into the mapping (no copy), JPEG frames are decoded
+        const uint8_t* p = payload(e);
+        if (p == nullptr || e.type != static_cast<uint32_t>(RecordType::Frame) || e.size < sizeof(FramePayload))
+            return false;
+        FramePayload head;
+        std::memcpy(&head, p, sizeof(head));
+        const uint8_t* pixels = p + sizeof(head);
+        std::size_t bytes = e.size - sizeof(head);
+        if (head.encoding == static_cast<uint32_t>(FrameEncoding::Raw))
+            frame = cv::Mat(head.rows, head.cols, head.matType, const_cast<uint8_t*>(pixels));
+        else
+            frame = cv::imdecode(cv::Mat(1, static_cast<int>(bytes), CV_8UC1, const_cast<uint8_t*>(pixels)), cv::IMREAD_COLOR);
+        return !frame.empty();
+    }
+    bool read_imu(const IndexEntry& e, ImuSample& sample) const {
+        const uint8_t* p = payload(e);
+        if (p == nullptr || e.type != static_cast<uint32_t>(RecordType::Imu) || e.size != sizeof(sample))
+            return false;
+        std::memcpy(&sample, p, sizeof(sample));
+        return true;
+    }
+    bool read_lidar(const IndexEntry& e, LidarSample& sample) const {
+        const uint8_t* p = payload(e);
+        if (p == nullptr || e.type != static_cast<uint32_t>(RecordType::Lidar) || e.size != sizeof(sample))
+            return false;
+        std::memcpy(&sample, p, sizeof(sample));
+        return true;
+    }
+};
@@ -0,0 +1,305 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+
+#include "audio.h"
+#include "lidar.h"
+#include "usfs_master.h"
+
+// --- Offline replay ---
+// A recorded session (video file, IMU log, lidar log) drives the unchanged decision logic. All threads follow one
+// simulated clock: the main loop advances it one IMU sample at a time, a video frame is only released once the
+// clock reaches its timestamp, and the clock does not move on until the pipeline finished that frame and the
+// distance thread consumed every lidar sample up to now. The same input therefore always produces the same warnings.
+//
+// IMU log, one sample per line (whitespace separated):
+//   t_ms event_status roll pitch yaw ax ay az gx gy gz mx my mz pressure temperature altitude
+// Lidar log, one sample per line:
+//   t_ms distance_cm
+
+class ReplayClock {
+private:
+    static constexpr double UNKNOWN = -1.0;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    double nowMs = 0.0;
+    double nextFrameMs = UNKNOWN; // Timestamp of the frame the video thread is waiting to release
+    bool frameInFlight = false;
+    bool videoEnded = false;
+    bool stopped = false;
+    double lidarIdleMs = UNKNOWN;
+    const std::atomic<bool>* lidarPaused;
+
+    bool realtime;
+    std::chrono::steady_clock::time_point wallStart;
+    std::chrono::steady_clock::time_point frameReleased;
+    uint64_t frames = 0;
+    double frameWallMs = 0.0;
+    double frameWallMaxMs = 0.0;
+
+    void pace(double ms) {
+        // In real-time mode simulated time never runs ahead of the wall clock
+        if (this->realtime)
+            std::this_thread::sleep_until(this->wallStart + std::chrono::microseconds(static_cast<int64_t>(ms * 1000.0)));
+    }
+    void wait_for_lidar(std::unique_lock<std::mutex>& lock) {
+        this->changed.wait(lock, [this] { return this->stopped || *this->lidarPaused || this->lidarIdleMs >= this->nowMs; });
+    }
+public:
+    ReplayClock(bool realtime, const std::atomic<bool>* lidarPaused) : lidarPaused(lidarPaused), realtime(realtime), wallStart(std::chrono::steady_clock::now()) {}
+
+    double now() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->nowMs;
+    }
+
+    // --- Main thread ---
+    bool advance_to(double t) {
+        // Releases and completes every frame up to t, then sets the clock to t; false once the video ended
+        std::unique_lock<std::mutex> lock(this->mutex);
+        for (;;) {
+            this->changed.wait(lock, [this] { return this->stopped || this->videoEnded || this->nextFrameMs != UNKNOWN; });
+            if (this->stopped || this->videoEnded)
+                return false;
+            if (this->nextFrameMs > t)
+                break;
+
+            double frameMs = this->nextFrameMs;
+            lock.unlock();
+            pace(frameMs);
+            lock.lock();
+            this->nowMs = frameMs;
+            wait_for_lidar(lock);
+            this->frameInFlight = true;
+            this->frameReleased = std::chrono::steady_clock::now();
+            this->changed.notify_all();
+            this->changed.wait(lock, [this] { return this->stopped || !this->frameInFlight; });
+        }
+        lock.unlock();
+        pace(t);
+        lock.lock();
+        if (t > this->nowMs)
+            this->nowMs = t;
+        wait_for_lidar(lock);
+        return !this->stopped;
+    }
+    void stop() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopped = true;
+        this->changed.notify_all();
+    }
+
+    // --- Video thread ---
+    bool reach(double frameMs) {
+        // Announce the next frame and block until the main loop released it
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->nextFrameMs = frameMs;
+        this->changed.notify_all();
+        this->changed.wait(lock, [this] { return this->stopped || this->frameInFlight; });
+        this->nextFrameMs = UNKNOWN;
+        return !this->stopped;
+    }
+    void end_of_video() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->videoEnded = true;
+        this->changed.notify_all();
+    }
+
+    // --- Pipeline stages ---
+    void frame_done() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->frameInFlight)
+            return;
+        double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->frameReleased).count();
+        this->frames += 1;
+        this->frameWallMs += wallMs;
+        if (wallMs > this->frameWallMaxMs)
+            this->frameWallMaxMs = wallMs;
+        this->frameInFlight = false;
+        this->changed.notify_all();
+    }
+
+    // --- Distance thread ---
+    void lidar_idle(double checkedMs) {
+        // The distance thread found no unread sample up to checkedMs
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->lidarIdleMs < checkedMs) {
+            this->lidarIdleMs = checkedMs;
+            this->changed.notify_all();
+        }
+    }
+
+    void log_summary() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->wallStart).count();
+        BOOST_LOG_TRIVIAL(info) << "Replay finished: " << this->frames << " frames over " << this->nowMs << " ms of recording in " << wallMs << " ms ("
+                                << (wallMs > 0.0 ? this->nowMs / wallMs : 0.0) << "x real time); frame latency mean "
+                                << (this->frames ? this->frameWallMs / this->frames : 0.0) << " ms, max " << this->frameWallMaxMs << " ms.";
+    }
+};
+
+class ReplayMotionSensor : public MotionSensor {
+private:
+    std::ifstream log;
+    std::string path;
+    std::string error = "No error";
+    double timestampMs = 0.0;
+    int eventStatus = 0;
+    float roll = 0.0f, pitch = 0.0f, yaw = 0.0f;
+    float ax = 0.0f, ay = 0.0f, az = 0.0f;
+    float gx = 0.0f, gy = 0.0f, gz = 0.0f;
+    float mx = 0.0f, my = 0.0f, mz = 0.0f;
+    float pressure = 1013.25f, temperature = 20.0f, altitude = 0.0f;
+public:
+    ReplayMotionSensor(std::string path) : path(path) {
+        BOOST_LOG_TRIVIAL(info) << "Constructing replay motion sensor class...";
+    }
+
+    bool next() {
+        // Load the next logged sample; false at the end of the log
+        std::string line;
+        while (std::getline(this->log, line)) {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream fields(line);
+            if (fields >> this->timestampMs >> this->eventStatus >> this->roll >> this->pitch >> this->yaw >> this->ax >> this->ay >> this->az
+                       >> this->gx >> this->gy >> this->gz >> this->mx >> this->my >> this->mz >> this->pressure >> this->temperature >> this->altitude)
+                return true;
+            BOOST_LOG_TRIVIAL(warning) << "Skipping malformed IMU log line: " << line;
+        }
+        return false;
+    }
+    double timestamp_ms() const {
+        return this->timestampMs;
+    }
+
+    bool begin(uint8_t bus=1) {
+        this->log.open(this->path);
+        if (!this->log.is_open()) {
+            this->error = "Unable to open IMU log " + this->path;
+            return false;
+        }
+        return true;
+    }
+    const char * getErrorString(void) {
+        return this->error.c_str();
+    }
+    void checkEventStatus(void) {}
+    uint8_t getEventStatus(void) {
+        return static_cast<uint8_t>(this->eventStatus);
+    }
+    bool gotError(void) {
+        return this->eventStatus & 0x02;
+    }
+
+    void Magnetometer(float& mx, float& my, float& mz) {
+        mx = this->mx; my = this->my; mz = this->mz;
+    }
+    void Accelerometer(float& ax, float& ay, float& az) {
+        ax = this->ax; ay = this->ay; az = this->az;
+    }
+    void Gyroscope(float& gx, float& gy, float& gz) {
+        gx = this->gx; gy = this->gy; gz = this->gz;
+    }
+    void Quaternion(float& roll, float& pitch, float& yaw) {
+        roll = this->roll; pitch = this->pitch; yaw = this->yaw;
+    }
+    void Barometer(float& pressure, float& temperature, float& altitude) {
+        pressure = this->pressure; temperature = this->temperature; altitude = this->altitude;
+    }
+};
+
+class ReplayLidar : public RangeSensor {
+private:
+    std::ifstream log;
+    std::string path;
+    ReplayClock* clock;
+    bool pending = false; // A sample was read ahead but its time has not come yet
+    double sampleMs = 0.0;
+    __u16 sampleDistance = 0;
+    __u16 lastDistance = 0;
+
+    bool peek() {
+        std::string line;
+        while (!this->pending && std::getline(this->log, line)) {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream fields(line);
+            if (fields >> this->sampleMs >> this->sampleDistance)
+                this->pending = true;
+        }
+        return this->pending;
+    }
+public:
+    ReplayLidar(std::string path, ReplayClock* clock) : path(path), clock(clock) {
+        BOOST_LOG_TRIVIAL(info) << "Constructing replay lidar class...";
+    }
+
+    bool i2c_init(void) {
+        this->log.open(this->path);
+        if (!this->log.is_open())
+            BOOST_LOG_TRIVIAL(error) << "Unable to open lidar log " << this->path;
+        return this->log.is_open();
+    }
+    __u8 getBusyFlag(__u8 lidarliteAddress = LIDARLITE_ADDR_DEFAULT) {
+        // Ready while a logged sample up to the current replay time is waiting to be read
+        double now = this->clock->now();
+        if (peek() && this->sampleMs <= now)
+            return 0x00;
+        this->clock->lidar_idle(now);
+        return 0x01;
+    }
+    void takeRange(__u8 lidarliteAddress = LIDARLITE_ADDR_DEFAULT) {}
+    __u16 readDistance(__u8 lidarliteAddress = LIDARLITE_ADDR_DEFAULT) {
+        if (peek()) {
+            this->lastDistance = this->sampleDistance;
+            this->pending = false;
+        }
+        return this->lastDistance;
+    }
+};
+
+class NullAudioPlayer : public AudioSink {
+private:
+    static const int NUM_CHANNELS = 2;
+
+    ReplayClock* clock;
+    std::ostream& out;
+    double sampleMs;
+    double channelEndMs[NUM_CHANNELS] = {0.0, 0.0};
+    uint64_t played[NUM_CHANNELS] = {0, 0};
+public:
+    NullAudioPlayer(ReplayClock* clock, std::ostream& out, double sampleMs = 1500.0) : clock(clock), out(out), sampleMs(sampleMs) {
+        BOOST_LOG_TRIVIAL(info) << "Constructing null audio player class...";
+    }
+    ~NullAudioPlayer() {
+        BOOST_LOG_TRIVIAL(info) << "Destructing null audio player class; " << this->played[0] << " warnings and " << this->played[1] << " beeps.";
+    }
+
+    void play_sample(int _s, int _c) {
+        // Every sample "plays" for a fixed time on the replay clock, so is_playing() gates warnings like the real mixer
+        if (_c < 0 || _c >= NUM_CHANNELS)
+            return;
+        double now = this->clock->now();
+        this->channelEndMs[_c] = now + this->sampleMs;
+        this->played[_c] += 1;
+        if (_c == 0) // Beeps are paced by the wall clock, not the replay clock, so only voice output is emitted
+            this->out << now << "\t" << _s << std::endl;
+    }
+    void set_volume(int _c, int _v) {}
+    bool is_playing(int _c) {
+        if (_c < 0 || _c >= NUM_CHANNELS)
+            return false;
+        return this->clock->now() < this->channelEndMs[_c];
+    }
+};
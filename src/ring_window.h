@@ -0,0 +1,187 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-capacity sliding window over the last N samples. Every statistic is updated incrementally on push(), so the
+// per-sample cost does not depend on how often the statistics are read and nothing is allocated after construction:
+//   mean / variance  sliding Welford update, O(1)
+//   slope            least-squares slope over the sample index (units per sample), O(1)
+// With OrderStatistics = true the window also keeps
+//   min / max        monotonic index queues, amortized O(1)
+//   median           sorted copy of the window, binary search plus one shift of at most N elements, so O(N)
+// The order statistics cost more per push() than the moments together; only windows that read them opt in.
+template<typename T, std::size_t N, bool OrderStatistics = false>
+class RingWindow {
+    static_assert(N > 0, "RingWindow needs a capacity of at least one sample");
+private:
+    static const uint64_t RESYNC_WRAPS = 64; // Recompute the sums from scratch every RESYNC_WRAPS * N samples to cancel drift
+
+    T samples[N];
+    T sorted[N];
+    std::size_t head = 0; // Slot the next sample is written to
+    std::size_t count = 0;
+    uint64_t pushed = 0;  // Total number of samples, used as a sequence number by the min/max queues
+
+    double meanVal = 0.0;
+    double m2 = 0.0;      // Sum of squared deviations from the mean
+    double sum = 0.0;
+    double indexSum = 0.0; // Sum of k * sample, k = 0 for the oldest sample
+
+    uint64_t minQueue[N], maxQueue[N];
+    std::size_t minHead = 0, minCount = 0;
+    std::size_t maxHead = 0, maxCount = 0;
+
+    const T& at_sequence(uint64_t seq) const {
+        return this->samples[seq % N];
+    }
+    template<typename Compare>
+    void queue_push(uint64_t* queue, std::size_t& qHead, std::size_t& qCount, uint64_t seq, Compare keep) {
+        // Drop the expired front, then every back entry the new sample dominates
+        if (qCount > 0 && queue[qHead] + N <= seq) {
+            qHead = (qHead + 1) % N;
+            qCount -= 1;
+        }
+        while (qCount > 0 && !keep(at_sequence(queue[(qHead + qCount - 1) % N]), at_sequence(seq)))
+            qCount -= 1;
+        queue[(qHead + qCount) % N] = seq;
+        qCount += 1;
+    }
+    void sorted_replace(T oldValue, T newValue) {
+        // Remove oldValue from the sorted copy and insert newValue, shifting only the elements between the two slots
+        T* end = this->sorted + this->count;
+        T* from = std::lower_bound(this->sorted, end, oldValue);
+        if (newValue >= oldValue) {
+            T* to = std::upper_bound(from, end, newValue);
+            std::copy(from + 1, to, from);
+            *(to - 1) = newValue;
+        } else {
+            T* to = std::upper_bound(this->sorted, from, newValue);
+            std::copy_backward(to, from, from + 1);
+            *to = newValue;
+        }
+    }
+    void sorted_insert(T value) {
+        T* end = this->sorted + this->count;
+        T* to = std::upper_bound(this->sorted, end, value);
+        std::copy_backward(to, end, end + 1);
+        *to = value;
+    }
+    void resync() {
+        double total = 0.0, weighted = 0.0;
+        for (std::size_t k = 0; k < this->count; k++) {
+            double x = static_cast<double>(at(k));
+            total += x;
+            weighted += k * x;
+        }
+        this->sum = total;
+        this->indexSum = weighted;
+        this->meanVal = total / this->count;
+        double sq = 0.0;
+        for (std::size_t k = 0; k < this->count; k++) {
+            double d = static_cast<double>(at(k)) - this->meanVal;
+            sq += d * d;
+        }
+        this->m2 = sq;
+    }
+public:
+    void push(T value) {
+        double x = static_cast<double>(value);
+        if (this->count < N) {
+            if (OrderStatistics)
+                sorted_insert(value);
+            this->count += 1;
+            double delta = x - this->meanVal;
+            this->meanVal += delta / this->count;
+            this->m2 += delta * (x - this->meanVal);
+            this->indexSum += (this->count - 1) * x;
+            this->sum += x;
+        } else {
+            T oldValue = this->samples[this->head];
+            double y = static_cast<double>(oldValue);
+            double oldMean = this->meanVal;
+            this->meanVal += (x - y) / N;
+            this->m2 += (x - y) * (x - this->meanVal + y - oldMean);
+            this->indexSum += (N - 1) * x - (this->sum - y);
+            this->sum += x - y;
+            if (OrderStatistics)
+                sorted_replace(oldValue, value);
+        }
+        this->samples[this->head] = value;
+        this->head = (this->head + 1) % N;
+
+        uint64_t seq = this->pushed++;
+        if (OrderStatistics) {
+            queue_push(this->minQueue, this->minHead, this->minCount, seq, [](T a, T b) { return a < b; });
+            queue_push(this->maxQueue, this->maxHead, this->maxCount, seq, [](T a, T b) { return a > b; });
+        }
+
+        if (this->head == 0 && (this->pushed / N) % RESYNC_WRAPS == 0)
+            resync();
+    }
+    void clear() {
+        this->head = this->count = 0;
+        this->pushed = 0;
+        this->meanVal = this->m2 = this->sum = this->indexSum = 0.0;
+        this->minHead = this->minCount = this->maxHead = this->maxCount = 0;
+    }
+
+    // --- Window contents ---
+    std::size_t size() const {
+        return this->count;
+    }
+    static constexpr std::size_t capacity() {
+        return N;
+    }
+    bool empty() const {
+        return this->count == 0;
+    }
+    bool full() const {
+        return this->count == N;
+    }
+    const T& at(std::size_t k) const {
+        // k = 0 is the oldest sample in the window
+        return this->samples[(this->head + N - this->count + k) % N];
+    }
+    const T& oldest() const {
+        return at(0);
+    }
+    const T& newest() const {
+        return at(this->count - 1);
+    }
+
+    // --- Statistics (0 for an empty window) ---
+    double mean() const {
+        return this->meanVal;
+    }
+    double variance() const {
+        // Sample variance (n - 1 in the denominator)
+        return this->count > 1 ? std::max(this->m2, 0.0) / (this->count - 1) : 0.0;
+    }
+    double standard_deviation() const {
+        return std::sqrt(variance());
+    }
+    T min() const {
+        static_assert(OrderStatistics, "min() needs a RingWindow with OrderStatistics");
+        return this->minCount ? at_sequence(this->minQueue[this->minHead]) : T();
+    }
+    T max() const {
+        static_assert(OrderStatistics, "max() needs a RingWindow with OrderStatistics");
+        return this->maxCount ? at_sequence(this->maxQueue[this->maxHead]) : T();
+    }
+    T median() const {
+        // Lower median for an even number of samples
+        static_assert(OrderStatistics, "median() needs a RingWindow with OrderStatistics");
+        return this->count ? this->sorted[(this->count - 1) / 2] : T();
+    }
+    double slope() const {
+        // Least-squares fit of sample against its index in the window
+        if (this->count < 2)
+            return 0.0;
+        double n = static_cast<double>(this->count);
+        double indexTotal = n * (n - 1.0) / 2.0;
+        double indexSquares = (n - 1.0) * n * (2.0 * n - 1.0) / 6.0;
+        return (n * this->indexSum - indexTotal * this->sum) / (n * indexSquares - indexTotal * indexTotal);
+    }
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include <opencv2/core.hpp>
+
+#include <algorithm>
+
+// Decision region of the detection rules: boxes whose center lies outside these fractions of the frame width are
+// ignored, so the network does not need to see that part of the frame.
+const float DECISION_LEFT = 0.3f;
+const float DECISION_RIGHT = 0.7f;
+
+struct RoiConfig {
+    bool enabled = false;
+    float margin = 0.1f;          // Added left and right of the decision region, fraction of the frame width
+    float band = 1.0f;            // Height of the vertical band, fraction of the frame height; 1 keeps the full height
+    float levelPitchDeg = -75.0f; // Head pitch at which the band sits in the middle of the frame
+    float verticalFovDeg = 48.8f; // Camera field of view, converts head pitch into a band offset
+};
+
+// Part of the frame the network is fed with. Cropping to the decision region plus a margin gives relevant objects
+// more of the 300x300 input at the same inference cost. An object reaching beyond the margin is only partly visible
+// to the network, so its box, and the size the rules derive from it, is clipped at the region border.
+class InferenceRoi {
+private:
+    RoiConfig config;
+public:
+    InferenceRoi(const RoiConfig& config = RoiConfig()) : config(config) {}
+
+    bool enabled() const {
+        return this->config.enabled;
+    }
+    cv::Rect region(const cv::Size& frame, float pitchDeg) const {
+        // In frame coordinates; the whole frame when the mode is off
+        if (!this->config.enabled)
+            return cv::Rect(0, 0, frame.width, frame.height);
+        float margin = std::max(this->config.margin, 0.0f); // A negative margin would cut into the decision region
+        int left = static_cast<int>((DECISION_LEFT - margin) * frame.width);
+        int right = static_cast<int>((DECISION_RIGHT + margin) * frame.width);
+        left = std::min(std::max(left, 0), frame.width - 1);
+        right = std::max(std::min(right, frame.width), left + 1);
+
+        int height = static_cast<int>(std::min(std::max(this->config.band, 0.1f), 1.0f) * frame.height);
+        // Looking down moves the horizon up in the image, so the band follows the head pitch
+        float offset = (pitchDeg - this->config.levelPitchDeg) / this->config.verticalFovDeg * frame.height;
+        int top = static_cast<int>((frame.height - height) / 2 + offset);
+        top = std::min(std::max(top, 0), frame.height - height);
+        return cv::Rect(left, top, right - left, height);
+    }
+    static cv::Rect map_box(const float* detection, const cv::Rect& region) {
+        // Detection row (image, class, confidence, box normalized to the region) -> box in frame coordinates
+        int x1 = region.x + static_cast<int>(detection[3] * region.width);
+        int y1 = region.y + static_cast<int>(detection[4] * region.height);
+        int x2 = region.x + static_cast<int>(detection[5] * region.width);
+        int y2 = region.y + static_cast<int>(detection[6] * region.height);
+        return cv::Rect(cv::Point(x1, y1), cv::Point(x2, y2));
+    }
+};
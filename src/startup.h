@@ -0,0 +1,119 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+
+// Runs the slow startup steps (model load, sensor bring-up, camera pipeline) side by side while the announcements
+// play. Each step reports readiness when it returns; main() waits on those events instead of fixed sleeps. The
+// clock starts when the object is constructed, so a global instance measures from process start.
+class StartupOrchestrator {
+private:
+    struct Task {
+        std::string name;
+        std::thread thread;
+        bool done = false;
+        bool ok = false;
+        double ms = 0.0;
+    };
+
+    std::chrono::steady_clock::time_point started;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::list<Task> tasks;
+    bool anyFailed = false;
+    std::atomic<bool> detected;
+
+    static const int POLL_MS = 20; // Re-check of conditions nothing notifies about, e.g. the end of an announcement
+public:
+    StartupOrchestrator() : started(std::chrono::steady_clock::now()), detected(false) {}
+    ~StartupOrchestrator() {
+        join();
+    }
+
+    double elapsed_ms() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->started).count();
+    }
+
+    void launch(const std::string& name, std::function<bool()> work) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->tasks.emplace_back();
+        Task* task = &this->tasks.back();
+        task->name = name;
+        task->thread = std::thread([this, task, work] {
+            auto start = std::chrono::steady_clock::now();
+            bool ok = false;
+            try {
+                ok = work();
+            } catch (const std::exception& e) {
+                BOOST_LOG_TRIVIAL(error) << "Startup step '" << task->name << "' threw: " << e.what();
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            BOOST_LOG_TRIVIAL(info) << "Startup step '" << task->name << "' " << (ok ? "ready" : "FAILED") << " after " << ms
+                                    << " ms (" << elapsed_ms() << " ms since start).";
+            std::lock_guard<std::mutex> lock(this->mutex);
+            task->done = true;
+            task->ok = ok;
+            task->ms = ms;
+            if (!ok)
+                this->anyFailed = true;
+            this->changed.notify_all();
+        });
+    }
+
+    // --- Readiness ---
+    bool failed() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->anyFailed;
+    }
+    bool ready() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (const Task& task : this->tasks) {
+            if (!task.done)
+                return false;
+        }
+        return true;
+    }
+    void wait_until(std::function<bool()> condition) {
+        // Returns once condition() holds; woken by every finished step and polled in between for outside events
+        std::unique_lock<std::mutex> lock(this->mutex);
+        for (;;) {
+            lock.unlock();
+            bool met = condition();
+            lock.lock();
+            if (met)
+                return;
+            this->changed.wait_for(lock, std::chrono::milliseconds(static_cast<int>(POLL_MS)));
+        }
+    }
+    bool wait_all() {
+        // Joins every step; true if all of them succeeded
+        join();
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return !this->anyFailed;
+    }
+    void join() {
+        for (Task& task : this->tasks) {
+            if (task.thread.joinable())
+                task.thread.join();
+        }
+    }
+
+    // --- Milestones ---
+    void mark(const std::string& milestone) {
+        BOOST_LOG_TRIVIAL(info) << "Startup: " << milestone << " after " << elapsed_ms() << " ms.";
+    }
+    void first_detection() {
+        // Called after every inference pass; only the first one is reported
+        if (this->detected.exchange(true))
+            return;
+        BOOST_LOG_TRIVIAL(info) << "Time to first detection: " << elapsed_ms() << " ms.";
+    }
+};
@@ -0,0 +1,231 @@
+#pragma once
+#include <opencv2/core.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Links detections across frames so the network does not have to run on every frame. Each track follows its box
+// with a constant-velocity Kalman filter; between network passes the boxes are predicted forward in time and the
+// track confidence decays, and a pass is requested every detectInterval frames or as soon as a track grows stale.
+
+struct TrackedDetection {
+    int objectClass;
+    float confidence;
+    cv::Rect box; // Frame coordinates
+};
+
+// Position and velocity of one box coordinate. The four coordinates of a box are filtered independently, which is
+// exact for a constant-velocity model with diagonal process and measurement noise.
+class KalmanAxis {
+private:
+    double x = 0.0, v = 0.0;               // Position (px) and velocity (px/ms)
+    double pxx = 0.0, pxv = 0.0, pvv = 0.0; // Covariance
+public:
+    void init(double position, double positionVar, double velocityVar) {
+        this->x = position;
+        this->v = 0.0;
+        this->pxx = positionVar;
+        this->pxv = 0.0;
+        this->pvv = velocityVar;
+    }
+    void predict(double dtMs, double accelVar) {
+        // Process noise of a random acceleration with variance accelVar (px^2/ms^4)
+        double dt2 = dtMs * dtMs;
+        this->x += this->v * dtMs;
+        this->pxx += 2.0 * dtMs * this->pxv + dt2 * this->pvv + accelVar * dt2 * dt2 / 4.0;
+        this->pxv += dtMs * this->pvv + accelVar * dt2 * dtMs / 2.0;
+        this->pvv += accelVar * dt2;
+    }
+    void update(double measured, double measurementVar) {
+        double s = this->pxx + measurementVar;
+        double kx = this->pxx / s, kv = this->pxv / s;
+        double residual = measured - this->x;
+        this->x += kx * residual;
+        this->v += kv * residual;
+        this->pvv -= kv * this->pxv;
+        this->pxv -= kv * this->pxx;
+        this->pxx -= kx * this->pxx;
+    }
+    double position() const {
+        return this->x;
+    }
+    double velocity() const {
+        return this->v;
+    }
+};
+
+struct Track {
+    int id;
+    int objectClass;
+    float confidence; // Detection confidence, decayed while the track is only predicted
+    float detectedConfidence;
+    int hits = 1;     // Network passes that matched this track
+    int misses = 0;   // Consecutive network passes that did not
+    double updatedMs; // Time of the last matched detection
+    double predictedMs;
+    KalmanAxis cx, cy, w, h;
+
+    cv::Rect box() const {
+        double width = std::max(this->w.position(), 1.0), height = std::max(this->h.position(), 1.0);
+        return cv::Rect(static_cast<int>(this->cx.position() - width / 2), static_cast<int>(this->cy.position() - height / 2),
+                        static_cast<int>(width), static_cast<int>(height));
+    }
+    double diagonal() const {
+        return std::sqrt(this->w.position() * this->w.position() + this->h.position() * this->h.position());
+    }
+    double diagonal_rate() const {
+        // Growth of the box diagonal in px/s
+        double d = diagonal();
+        if (d <= 0.0)
+            return 0.0;
+        return 1000.0 * (this->w.position() * this->w.velocity() + this->h.position() * this->h.velocity()) / d;
+    }
+    double approach_rate() const {
+        // Relative diagonal growth per second; positive while the object gets closer, 1 / rate is the time to contact
+        double d = diagonal();
+        return d > 0.0 ? diagonal_rate() / d : 0.0;
+    }
+};
+
+struct TrackerConfig {
+    int detectInterval = 1;          // Run the network on every Nth frame; 1 disables prediction-only frames
+    float minIoU = 0.3f;             // Association threshold between a predicted track and a detection
+    float staleFraction = 0.5f;      // A track decayed below this fraction of its detected confidence forces a network pass
+    double confidenceHalfLifeMs = 400.0;
+    int maxMisses = 2;               // Network passes a track may go unmatched before it is dropped
+    double positionNoisePx = 8.0;    // Measurement noise of a box coordinate (standard deviation)
+    double accelerationNoise = 2e-4; // px/ms^2, standard deviation of the unmodelled acceleration
+};
+
+class Tracker {
+private:
+    TrackerConfig config;
+    std::vector<Track> active;
+    int nextId = 0;
+    int framesSinceDetection;
+
+    // Scratch space reused every pass
+    struct Pair {
+        float iou;
+        int track, detection;
+    };
+    std::vector<Pair> pairs;
+    std::vector<bool> trackMatched, detectionMatched;
+
+    static float iou(const cv::Rect& a, const cv::Rect& b) {
+        int x1 = std::max(a.x, b.x), y1 = std::max(a.y, b.y);
+        int x2 = std::min(a.x + a.width, b.x + b.width), y2 = std::min(a.y + a.height, b.y + b.height);
+        if (x2 <= x1 || y2 <= y1)
+            return 0.0f;
+        float intersection = static_cast<float>(x2 - x1) * (y2 - y1);
+        return intersection / (static_cast<float>(a.width) * a.height + static_cast<float>(b.width) * b.height - intersection);
+    }
+    void advance(double nowMs) {
+        double accelVar = this->config.accelerationNoise * this->config.accelerationNoise;
+        for (Track& t : this->active) {
+            double dt = nowMs - t.predictedMs;
+            if (dt <= 0.0)
+                continue;
+            t.cx.predict(dt, accelVar);
+            t.cy.predict(dt, accelVar);
+            t.w.predict(dt, accelVar);
+            t.h.predict(dt, accelVar);
+            t.confidence *= static_cast<float>(std::pow(0.5, dt / this->config.confidenceHalfLifeMs));
+            t.predictedMs = nowMs;
+        }
+    }
+    void correct(Track& t, const TrackedDetection& d, double nowMs) {
+        double var = this->config.positionNoisePx * this->config.positionNoisePx;
+        t.cx.update(d.box.x + d.box.width / 2.0, var);
+        t.cy.update(d.box.y + d.box.height / 2.0, var);
+        t.w.update(d.box.width, var);
+        t.h.update(d.box.height, var);
+        t.confidence = t.detectedConfidence = d.confidence;
+        t.hits += 1;
+        t.misses = 0;
+        t.updatedMs = nowMs;
+    }
+    void start(const TrackedDetection& d, double nowMs) {
+        double var = this->config.positionNoisePx * this->config.positionNoisePx;
+        double velocityVar = 0.5 * 0.5; // px/ms, unknown until the second detection
+        Track t;
+        t.id = this->nextId++;
+        t.objectClass = d.objectClass;
+        t.confidence = t.detectedConfidence = d.confidence;
+        t.updatedMs = t.predictedMs = nowMs;
+        t.cx.init(d.box.x + d.box.width / 2.0, var, velocityVar);
+        t.cy.init(d.box.y + d.box.height / 2.0, var, velocityVar);
+        t.w.init(d.box.width, var, velocityVar);
+        t.h.init(d.box.height, var, velocityVar);
+        this->active.push_back(t);
+    }
+public:
+    Tracker(const TrackerConfig& config = TrackerConfig()) : config(config), framesSinceDetection(config.detectInterval) {}
+
+    bool enabled() const {
+        return this->config.detectInterval > 1;
+    }
+    bool should_detect() const {
+        // Whether the coming frame needs a network pass
+        if (this->framesSinceDetection + 1 >= this->config.detectInterval)
+            return true;
+        for (const Track& t : this->active) {
+            if (t.confidence < this->config.staleFraction * t.detectedConfidence)
+                return true;
+        }
+        return false;
+    }
+
+    void update(const std::vector<TrackedDetection>& detections, double nowMs) {
+        // Network pass: predict every track to nowMs, then match greedily by IoU within the same class
+        advance(nowMs);
+        this->framesSinceDetection = 0;
+        this->pairs.clear();
+        for (std::size_t t = 0; t < this->active.size(); t++) {
+            cv::Rect predicted = this->active[t].box();
+            for (std::size_t d = 0; d < detections.size(); d++) {
+                if (detections[d].objectClass != this->active[t].objectClass)
+                    continue;
+                float overlap = iou(predicted, detections[d].box);
+                if (overlap >= this->config.minIoU)
+                    this->pairs.push_back({overlap, static_cast<int>(t), static_cast<int>(d)});
+            }
+        }
+        std::sort(this->pairs.begin(), this->pairs.end(), [](const Pair& a, const Pair& b) { return a.iou > b.iou; });
+        this->trackMatched.assign(this->active.size(), false);
+        this->detectionMatched.assign(detections.size(), false);
+        for (const Pair& p : this->pairs) {
+            if (this->trackMatched[p.track] || this->detectionMatched[p.detection])
+                continue;
+            this->trackMatched[p.track] = this->detectionMatched[p.detection] = true;
+            correct(this->active[p.track], detections[p.detection], nowMs);
+        }
+
+        std::size_t kept = 0;
+        for (std::size_t t = 0; t < this->active.size(); t++) {
+            if (!this->trackMatched[t])
+                this->active[t].misses += 1;
+            if (this->active[t].misses <= this->config.maxMisses)
+                this->active[kept++] = this->active[t];
+        }
+        this->active.resize(kept);
+        for (std::size_t d = 0; d < detections.size(); d++) {
+            if (!this->detectionMatched[d])
+                start(detections[d], nowMs);
+        }
+    }
+    void predict(double nowMs) {
+        // Frame without a network pass
+        advance(nowMs);
+        this->framesSinceDetection += 1;
+    }
+    void clear() {
+        this->active.clear();
+        this->framesSinceDetection = this->config.detectInterval; // The next frame starts over with a network pass
+    }
+
+    const std::vector<Track>& tracks() const {
+        return this->active;
+    }
+};
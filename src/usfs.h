@@ -26,6 +26,7 @@
 #include <stdint.h>
 #include <time.h>
 #include "I2C_core.h"
+#include "i2c_bus.h"
 #if defined(ARDUINO)
 #include <Arduino.h>
 #elif defined(__arm__) 
@@ -134,6 +135,8 @@ class Usfs {
 
         static const uint8_t ADDRESS           = 0x28;   // Address of the USFS SENtral sensor hub
 
+        static const uint8_t DATA_BLOCK_LENGTH = EventStatus + 1;  // QX .. EventStatus, every output register in one read
+
 
         bool hasFeature(uint8_t features) {
 			return features & readRegister(FeatureFlags);
@@ -142,8 +145,9 @@ class Usfs {
         static const uint8_t TEMP_OUT_H       = 0x41;
         static const uint8_t TEMP_OUT_L       = 0x42;
 
-        // Cross-platform support
-        uint8_t _i2c;
+        // All register traffic goes through the shared bus arbiter
+        I2CBus * _bus = nullptr;
+        int _device = -1;
 
         uint8_t errorStatus;
 
@@ -161,19 +165,23 @@ class Usfs {
 			readRegisters(subAddress, 1, &data);
 			return data;                       
 		}
-        void readRegisters(uint8_t subAddress, uint8_t count, uint8_t * dest) {
-			cpi2c_readRegisters(_i2c, subAddress, count, dest);
+        bool readRegisters(uint8_t subAddress, uint8_t count, uint8_t * dest) {
+			// One combined transfer for the whole block
+			return _bus->read_registers(_device, ADDRESS, subAddress, dest, count);
 		}
         void writeRegister(uint8_t subAddress, uint8_t data) {
-			 cpi2c_writeRegister(_i2c, subAddress, data);
+			_bus->write_register(_device, ADDRESS, subAddress, data);
 		}
 
     public:
 
         bool begin(uint8_t bus=1) {
-			_i2c = cpi2c_open(ADDRESS, bus);
-			
 			errorStatus = 0;
+
+			_bus = I2CBus::open(bus);
+			if (_bus == nullptr)
+				return false;
+			_device = _bus->register_device("USFS", ADDRESS, BusPriority::Realtime);
 		
 			// Check SENtral status, make sure EEPROM upload of firmware was accomplished
 			for (int attempts=0; attempts<10; ++attempts) {
@@ -467,6 +475,10 @@ class Usfs {
         void readGyrometer(int16_t & gx, int16_t & gy, int16_t & gz) {
 			readThreeAxis(GX, gx, gy, gz);
 		}
+        bool readDataBlock(uint8_t * dest) {
+			// Registers 0x00-0x35 into dest[DATA_BLOCK_LENGTH]
+			return readRegisters(QX, DATA_BLOCK_LENGTH, dest);
+		}
         void readQuaternion(float & qw, float & qx, float & qy, float & qz) {
 			uint8_t rawData[16];  // x/y/z/w quaternion register data stored here (note unusual order!)
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "usfs.h"
+#include <chrono>
 #include <iostream>
 #include <math.h>
 #include <stdio.h>
@@ -8,13 +9,70 @@
 #include <boost/log/core.hpp>
 #include <boost/log/trivial.hpp>
 
-class USFS {
+#include "async_log.h"
+
+// What the main loop needs from a motion sensor, so recorded data can stand in for the hardware. The accessors always
+// report the latest sample of their sensor; whether it arrived since the previous checkEventStatus() is told by the
+// freshness bits of getEventStatus().
+class MotionSensor {
+    public:
+        static const uint8_t QUATERNION = 0x04;
+        static const uint8_t MAGNETOMETER = 0x08;
+        static const uint8_t ACCELEROMETER = 0x10;
+        static const uint8_t GYROSCOPE = 0x20;
+        static const uint8_t BAROMETER = 0x40;
+
+        virtual ~MotionSensor() {}
+
+        virtual bool begin(uint8_t bus=1) = 0;
+        virtual const char * getErrorString(void) = 0;
+        virtual void checkEventStatus(void) = 0;
+        virtual uint8_t getEventStatus(void) = 0;
+        virtual bool gotError(void) = 0;
+
+        virtual void Magnetometer(float& mx, float& my, float& mz) = 0;
+        virtual void Accelerometer(float& ax, float& ay, float& az) = 0;
+        virtual void Gyroscope(float& gx, float& gy, float& gz) = 0;
+        virtual void Quaternion(float& roll, float& pitch, float& yaw) = 0;
+        virtual void Barometer(float& pressure, float& temperature, float& altitude) = 0;
+
+        bool isFresh(uint8_t sensor) {
+            return (getEventStatus() & sensor) != 0;
+        }
+};
+
+// Every USFS output decoded from one burst read of registers 0x00-0x35. The hub stamps each sensor with a 16-bit
+// counter (31.25 us per tick, wraps every 2.048 s); a sensor counts as fresh when its stamp moved since the last read.
+struct MotionSnapshot {
+    std::chrono::steady_clock::time_point hostTime; // When the burst completed
+    uint8_t eventStatus;                           // EventStatus register plus the freshness bits below
+    uint8_t fresh;                                 // Same bit layout as EventStatus: 0x04 Q, 0x08 M, 0x10 A, 0x20 G, 0x40 baro
+
+    uint16_t qTime, mTime, aTime, gTime, baroTime, tempTime;
+
+    float qw, qx, qy, qz;
+    float roll, pitch, yaw;
+    float mx, my, mz;
+    float ax, ay, az;
+    float gx, gy, gz;
+    float pressure, temperature, altitude;
+};
+
+class USFS : public MotionSensor {
     private:
 
         Usfs _usfs;
 
         uint8_t _eventStatus;
+        MotionSnapshot _snapshot = MotionSnapshot();
+        uint64_t _readErrors = 0;
 
+        static int16_t int16At(const uint8_t * buf) {
+            return (int16_t) (((int16_t)buf[1] << 8) | buf[0]);
+        }
+        static uint16_t uint16At(const uint8_t * buf) {
+            return (uint16_t) (((uint16_t)buf[1] << 8) | buf[0]);
+        }
         uint8_t _magRate;      // Hz
         uint16_t _accelRate;    // Hz
         uint16_t _gyroRate;     // Hz
@@ -33,6 +91,19 @@ class USFS {
 
     public:
 
+        // Degrees; yaw corrected for the local magnetic declination
+        static void quaternionToEuler(float qw, float qx, float qy, float qz, float& roll, float& pitch, float& yaw) {
+            roll  = atan2(2.0f * (qw * qx + qy * qz), qw * qw - qx * qx - qy * qy + qz * qz);
+            pitch = -asin(2.0f * (qx * qz - qw * qy));
+            yaw   = atan2(2.0f * (qx * qy + qw * qz), qw * qw + qx * qx - qy * qy - qz * qz);   
+
+            pitch *= 180.0f / M_PI;
+            yaw *= 180.0f / M_PI; 
+            yaw += 13.8f;
+            if(yaw < 0) yaw += 360.0f;
+            roll  *= 180.0f / M_PI;
+        }
+
         USFS(uint8_t  magRate, uint16_t accelRate, uint16_t gyroRate, uint8_t  baroRate, uint8_t qRateDivisor) {
             BOOST_LOG_TRIVIAL(info) << "Constructing USFS class...";
             this->_magRate = magRate;
@@ -83,7 +154,66 @@ class USFS {
         }
 
         void checkEventStatus(void) {
-            _eventStatus = _usfs.getEventStatus();
+            // One burst read per loop; the accessors below decode from the snapshot instead of touching the bus
+            readSnapshot(_snapshot);
+            _eventStatus = _snapshot.eventStatus;
+        }
+
+        bool readSnapshot(MotionSnapshot& snapshot) {
+            uint8_t raw[Usfs::DATA_BLOCK_LENGTH];
+            if (!_usfs.readDataBlock(raw)) {
+                if (_readErrors++ == 0)
+                    BOOST_LOG_TRIVIAL(warning) << "Reading the USFS data registers failed; keeping the previous sample.";
+                snapshot.fresh = 0;
+                snapshot.eventStatus = 0;
+                return false;
+            }
+            uint16_t qTime = uint16At(&raw[Usfs::QTIME]), mTime = uint16At(&raw[Usfs::MTIME]);
+            uint16_t aTime = uint16At(&raw[Usfs::ATIME]), gTime = uint16At(&raw[Usfs::GTIME]);
+            uint16_t baroTime = uint16At(&raw[Usfs::BaroTIME]), tempTime = uint16At(&raw[Usfs::TempTIME]);
+
+            // The event flags are cleared by this very read, so a sample that lands mid-transfer is caught by its stamp
+            uint8_t fresh = 0;
+            if (qTime != snapshot.qTime) fresh |= 0x04;
+            if (mTime != snapshot.mTime) fresh |= 0x08;
+            if (aTime != snapshot.aTime) fresh |= 0x10;
+            if (gTime != snapshot.gTime) fresh |= 0x20;
+            if (baroTime != snapshot.baroTime || tempTime != snapshot.tempTime) fresh |= 0x40;
+
+            snapshot.hostTime = std::chrono::steady_clock::now();
+            snapshot.fresh = fresh;
+            snapshot.eventStatus = raw[Usfs::EventStatus] | fresh;
+            snapshot.qTime = qTime; snapshot.mTime = mTime; snapshot.aTime = aTime; snapshot.gTime = gTime;
+            snapshot.baroTime = baroTime; snapshot.tempTime = tempTime;
+
+            snapshot.qx = Usfs::uint32_reg_to_float(&raw[Usfs::QX]);
+            snapshot.qy = Usfs::uint32_reg_to_float(&raw[Usfs::QY]);
+            snapshot.qz = Usfs::uint32_reg_to_float(&raw[Usfs::QZ]);
+            snapshot.qw = Usfs::uint32_reg_to_float(&raw[Usfs::QW]);
+            quaternionToEuler(snapshot.qw, snapshot.qx, snapshot.qy, snapshot.qz, snapshot.roll, snapshot.pitch, snapshot.yaw);
+
+            snapshot.mx = int16At(&raw[Usfs::MX]) * 0.305176f;
+            snapshot.my = int16At(&raw[Usfs::MY]) * 0.305176f;
+            snapshot.mz = int16At(&raw[Usfs::MZ]) * 0.305176f;
+            snapshot.ax = int16At(&raw[Usfs::AX]) * 0.000488f;
+            snapshot.ay = int16At(&raw[Usfs::AY]) * 0.000488f;
+            snapshot.az = int16At(&raw[Usfs::AZ]) * 0.000488f;
+            snapshot.gx = int16At(&raw[Usfs::GX]) * 0.153f;
+            snapshot.gy = int16At(&raw[Usfs::GY]) * 0.153f;
+            snapshot.gz = int16At(&raw[Usfs::GZ]) * 0.153f;
+
+            snapshot.pressure = (float)int16At(&raw[Usfs::Baro]) * .01f + 1013.25f; // millibars
+            snapshot.temperature = (float)int16At(&raw[Usfs::Temp]) * 0.01f;        // degrees C
+            snapshot.altitude = (1.0f - powf(snapshot.pressure / 1013.25f, 0.190295f)) * 44330.0f;
+            return true;
+        }
+
+        const MotionSnapshot& snapshot(void) const {
+            return _snapshot;
+        }
+
+        uint8_t getEventStatus(void) {
+            return _eventStatus;
         }
 
         bool gotError(void) {
@@ -134,49 +264,31 @@ class USFS {
             _usfs.readBarometer(pressure, temperature);
         }
 
+        // A sensor without a fresh sample is only recorded as a binary ImuMissing event: these run every loop iteration,
+        // too often to build a text log record each time
         void Magnetometer(float& mx, float& my, float& mz) {
-            if (gotMagnetometer())
-                readMagnetometer(mx, my, mz);
-            else
-                BOOST_LOG_TRIVIAL(info) << "No magnetometer value provided.";
+            mx = _snapshot.mx; my = _snapshot.my; mz = _snapshot.mz;
+            if (!gotMagnetometer())
+                EventLog::global().emit(EventType::ImuMissing, {0.0f});
         }
         void Accelerometer(float& ax, float& ay, float& az) {
-            if (gotAccelerometer())
-                readAccelerometer(ax, ay, az);
-            else
-                BOOST_LOG_TRIVIAL(info) << "No accelerometer value provided.";
+            ax = _snapshot.ax; ay = _snapshot.ay; az = _snapshot.az;
+            if (!gotAccelerometer())
+                EventLog::global().emit(EventType::ImuMissing, {1.0f});
         }
         void Gyroscope(float& gx, float& gy, float& gz) {
-            if (gotGyrometer())
-                readGyrometer(gx, gy, gz);
-            else
-                BOOST_LOG_TRIVIAL(info) << "No accelerometer value provided.";
+            gx = _snapshot.gx; gy = _snapshot.gy; gz = _snapshot.gz;
+            if (!gotGyrometer())
+                EventLog::global().emit(EventType::ImuMissing, {2.0f});
         }
         void Quaternion(float& roll, float& pitch, float& yaw) {
-            if (gotQuaternion()) {
-                float qw, qx, qy, qz;
-
-                readQuaternion(qw, qx, qy, qz);
-
-                roll  = atan2(2.0f * (qw * qx + qy * qz), qw * qw - qx * qx - qy * qy + qz * qz);
-                pitch = -asin(2.0f * (qx * qz - qw * qy));
-                yaw   = atan2(2.0f * (qx * qy + qw * qz), qw * qw + qx * qx - qy * qy - qz * qz);   
-
-                pitch *= 180.0f / M_PI;
-                yaw *= 180.0f / M_PI; 
-                yaw += 13.8f;
-                if(yaw < 0) yaw += 360.0f;
-                roll  *= 180.0f / M_PI;
-            }
-            else
-                BOOST_LOG_TRIVIAL(info) << "No quaternion value provided.";
+            roll = _snapshot.roll; pitch = _snapshot.pitch; yaw = _snapshot.yaw;
+            if (!gotQuaternion())
+                EventLog::global().emit(EventType::ImuMissing, {3.0f});
         }
         void Barometer(float& pressure, float& temperature, float& altitude) {
-            if (gotBarometer()) {
-                readBarometer(pressure, temperature); 
-                altitude = (1.0f - powf(pressure / 1013.25f, 0.190295f)) * 44330.0f;
-            }
-            else
-                BOOST_LOG_TRIVIAL(info) << "No barometer value provided.";
+            pressure = _snapshot.pressure; temperature = _snapshot.temperature; altitude = _snapshot.altitude;
+            if (!gotBarometer())
+                EventLog::global().emit(EventType::ImuMissing, {4.0f});
         }
 };
@@ -0,0 +1,155 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+#include "audio.h"
+
+// Spoken warnings waiting for the voice channel. Every sample ID owns one slot, so deduplication is a single index
+// lookup and the structure never grows; pending samples sit in a heap ordered by priority (first posted wins a tie).
+// A sample is blocked from being posted again while it is pending, while it plays and for a short cooldown after.
+// Any thread may post; dispatch() is called by the thread that owns the audio output.
+class WarningScheduler {
+public:
+    static const int MAX_SAMPLES = 64;
+    static_assert(NUM_WAVEFORMS <= MAX_SAMPLES, "WarningScheduler needs one slot per waveform");
+private:
+    enum class State : uint8_t {Idle, Pending, Cooldown};
+    struct Slot {
+        State state = State::Idle;
+        int priority = 0;
+        uint64_t order = 0;     // Posting sequence, breaks priority ties
+        double expiresMs = 0.0; // Pending: dropped unplayed after this time (0 = never); Cooldown: blocked until this time
+    };
+
+    std::mutex mutex;
+    Slot slots[MAX_SAMPLES];
+    int heap[MAX_SAMPLES]; // Sample IDs of pending warnings
+    int heapSize = 0;
+    uint64_t posted = 0;
+    int playing = -1;      // Sample last started on the voice channel
+    uint64_t expired = 0;
+    uint64_t duplicates = 0;
+
+    std::function<double()> clockMs;
+    double cooldownMs;
+
+    struct Lower {
+        const Slot* slots;
+        bool operator()(int a, int b) const {
+            if (slots[a].priority != slots[b].priority)
+                return slots[a].priority < slots[b].priority;
+            return slots[a].order > slots[b].order;
+        }
+    };
+    void pop_top() {
+        std::pop_heap(this->heap, this->heap + this->heapSize, Lower{this->slots});
+        this->heapSize -= 1;
+    }
+public:
+    static double steady_ms() {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    WarningScheduler(double cooldownMs = 250.0) : clockMs(steady_ms), cooldownMs(cooldownMs) {}
+
+    void set_clock(std::function<double()> clockMs) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->clockMs = clockMs;
+    }
+
+    bool post(int sample, int priority, double ttlMs = 0.0) {
+        // Queue a warning unless the same sample is already pending or cooling down; ttlMs > 0 drops it if it could
+        // not be played in time
+        if (sample < 0 || sample >= MAX_SAMPLES)
+            return false;
+        std::lock_guard<std::mutex> lock(this->mutex);
+        double now = this->clockMs();
+        Slot& slot = this->slots[sample];
+        if (slot.state == State::Cooldown && (sample == this->playing || now < slot.expiresMs)) {
+            this->duplicates += 1;
+            return false;
+        }
+        if (slot.state == State::Pending) {
+            if (slot.expiresMs == 0.0 || now < slot.expiresMs) {
+                this->duplicates += 1;
+                return false;
+            }
+            // Stale but not yet popped: refresh it in place
+            slot.expiresMs = ttlMs > 0.0 ? now + ttlMs : 0.0;
+            if (slot.priority != priority) {
+                slot.priority = priority;
+                std::make_heap(this->heap, this->heap + this->heapSize, Lower{this->slots});
+            }
+            return true;
+        }
+        slot.state = State::Pending;
+        slot.priority = priority;
+        slot.order = this->posted++;
+        slot.expiresMs = ttlMs > 0.0 ? now + ttlMs : 0.0;
+        this->heap[this->heapSize++] = sample;
+        std::push_heap(this->heap, this->heap + this->heapSize, Lower{this->slots});
+        return true;
+    }
+    bool contains(int sample) {
+        // Whether posting sample right now would be rejected as a duplicate
+        if (sample < 0 || sample >= MAX_SAMPLES)
+            return false;
+        std::lock_guard<std::mutex> lock(this->mutex);
+        const Slot& slot = this->slots[sample];
+        return slot.state == State::Pending || (slot.state == State::Cooldown && (sample == this->playing || this->clockMs() < slot.expiresMs));
+    }
+
+    int dispatch(AudioSink* player, int channel = 0) {
+        // Plays the most important pending warning if the channel is free; returns its sample ID or -1
+        std::lock_guard<std::mutex> lock(this->mutex);
+        double now = this->clockMs();
+        if (player->is_playing(channel)) {
+            if (this->playing != -1) // The cooldown starts when playback ends
+                this->slots[this->playing].expiresMs = now + this->cooldownMs;
+            return -1;
+        }
+        this->playing = -1;
+
+        while (this->heapSize > 0) {
+            int sample = this->heap[0];
+            Slot& slot = this->slots[sample];
+            pop_top();
+            if (slot.expiresMs != 0.0 && now >= slot.expiresMs) {
+                slot.state = State::Idle;
+                this->expired += 1;
+                continue;
+            }
+            player->play_sample(sample, channel);
+            slot.state = State::Cooldown;
+            slot.expiresMs = now + this->cooldownMs;
+            this->playing = sample;
+            return sample;
+        }
+        return -1;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (int i = 0; i < MAX_SAMPLES; i++)
+            this->slots[i] = Slot();
+        this->heapSize = 0;
+        this->playing = -1;
+    }
+
+    // --- Statistics ---
+    int pending() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->heapSize;
+    }
+    uint64_t expired_count() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->expired;
+    }
+    uint64_t duplicate_count() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->duplicates;
+    }
+};